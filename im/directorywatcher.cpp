@@ -0,0 +1,116 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "directorywatcher.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/stringutils.h>
+#include <string>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+
+#if __has_include(<sys/inotify.h>)
+#include <sys/inotify.h>
+#define HAS_INOTIFY 1
+#endif
+
+namespace fcitx {
+
+DirectoryWatcher::DirectoryWatcher(EventLoop *loop, Callback callback,
+                                   uint64_t delay)
+    : loop_(loop), callback_(std::move(callback)), delay_(delay) {
+#ifdef HAS_INOTIFY
+    fd_.give(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if (!fd_.isValid()) {
+        return;
+    }
+    ioEvent_ = loop_->addIOEvent(fd_.fd(), IOEventFlag::In,
+                                 [this](EventSourceIO *, int, IOEventFlags) {
+                                     readEvents();
+                                     return true;
+                                 });
+    timer_ = loop_->addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + delay_, 0,
+        [this](EventSourceTime *, uint64_t) {
+            auto paths = std::move(pending_);
+            pending_.clear();
+            if (!paths.empty()) {
+                callback_(paths);
+            }
+            return true;
+        });
+    timer_->setEnabled(false);
+#endif
+}
+
+DirectoryWatcher::~DirectoryWatcher() = default;
+
+bool DirectoryWatcher::addDirectory(const std::string &directory) {
+#ifdef HAS_INOTIFY
+    if (!fd_.isValid()) {
+        return false;
+    }
+    int wd = inotify_add_watch(fd_.fd(), directory.data(),
+                               IN_CREATE | IN_DELETE | IN_CLOSE_WRITE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                                   IN_ONLYDIR);
+    if (wd < 0) {
+        return false;
+    }
+    directories_[wd] = directory;
+    return true;
+#else
+    FCITX_UNUSED(directory);
+    return false;
+#endif
+}
+
+void DirectoryWatcher::readEvents() {
+#ifdef HAS_INOTIFY
+    alignas(struct inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t len = read(fd_.fd(), buffer, sizeof(buffer));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            break;
+        }
+        for (ssize_t offset = 0; offset < len;) {
+            const auto *event =
+                reinterpret_cast<const struct inotify_event *>(buffer +
+                                                               offset);
+            offset += sizeof(struct inotify_event) + event->len;
+            auto iter = directories_.find(event->wd);
+            if (iter == directories_.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                // The directory itself is gone.
+                pending_.insert(iter->second);
+                directories_.erase(iter);
+                continue;
+            }
+            if (event->len > 0) {
+                pending_.insert(
+                    stringutils::joinPath(iter->second, event->name));
+            }
+        }
+    }
+    if (!pending_.empty()) {
+        // Restart the delay on every change.
+        timer_->setNextInterval(delay_);
+        timer_->setOneShot();
+    }
+#endif
+}
+
+} // namespace fcitx
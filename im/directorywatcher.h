@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _IM_DIRECTORYWATCHER_H_
+#define _IM_DIRECTORYWATCHER_H_
+
+#include <cstdint>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/unixfd.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fcitx {
+
+// Watches the entries of a few directories with inotify. Changes are collected
+// for a short delay, so that e.g. a package update is reported once, with the
+// full paths of all files that were created, changed or removed.
+class DirectoryWatcher {
+public:
+    using Callback =
+        std::function<void(const std::unordered_set<std::string> &paths)>;
+
+    DirectoryWatcher(EventLoop *loop, Callback callback,
+                     uint64_t delay = 500000);
+    ~DirectoryWatcher();
+    DirectoryWatcher(const DirectoryWatcher &) = delete;
+    DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+    // Returns false if the directory can not be watched, e.g. because it does
+    // not exist or inotify is not available.
+    bool addDirectory(const std::string &directory);
+
+private:
+    void readEvents();
+
+    EventLoop *loop_;
+    Callback callback_;
+    uint64_t delay_;
+    UnixFD fd_;
+    std::unordered_map<int, std::string> directories_;
+    std::unique_ptr<EventSourceIO> ioEvent_;
+    std::unique_ptr<EventSourceTime> timer_;
+    std::unordered_set<std::string> pending_;
+};
+
+} // namespace fcitx
+
+#endif // _IM_DIRECTORYWATCHER_H_
@@ -5,15 +5,24 @@
  *
  */
 #include "engine.h"
-#include "keysymname.h"
+#include "directorywatcher.h"
+#include "imlistcache.h"
+#include "keysymbol.h"
+#include "mtextconverter.h"
+#include "m17n_public.h"
 #include "overrideparser.h"
+#include "spantimer.h"
+#include "usage.h"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
-#include <cstring>
+#include <cstdlib>
+#include <ctime>
 #include <fcitx-config/iniparser.h>
 #include <fcitx-utils/capabilityflags.h>
-#include <fcitx-utils/cutf8.h>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/eventdispatcher.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/key.h>
 #include <fcitx-utils/keysym.h>
@@ -27,16 +36,25 @@
 #include <fcitx/event.h>
 #include <fcitx/inputcontext.h>
 #include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodmanager.h>
 #include <fcitx/inputpanel.h>
 #include <fcitx/instance.h>
 #include <fcitx/text.h>
 #include <fcitx/userinterface.h>
 #include <fcntl.h>
+#include <filesystem>
 #include <format>
+#include <iterator>
+#include <list>
 #include <m17n-core.h>
 #include <m17n.h>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -49,22 +67,38 @@ namespace fcitx {
 
 namespace {
 
-std::string MTextToUTF8(MText *mt) {
-    // TODO Verify that bufsize is "just enough" in worst scenerio.
-    size_t bufsize =
-        (mtext_len(mt) + 1) * static_cast<size_t>(FCITX_UTF8_MAX_LENGTH);
-    std::vector<char> buf;
-    buf.resize(bufsize);
-    FCITX_M17N_DEBUG() << "MText buf size: " << bufsize;
+// Idle contexts kept per input method, and how long they are kept.
+constexpr size_t MaxPooledContexts = 4;
+constexpr uint64_t PooledContextTimeout = 5 * 60 * 1000000ULL;
+// How often states are checked against IdleTimeout.
+constexpr uint64_t IdleCheckInterval = 60 * 1000000ULL;
 
-    MConverter *mconv = mconv_buffer_converter(
-        Mcoding_utf_8, reinterpret_cast<unsigned char *>(buf.data()), bufsize);
-    mconv_encode(mconv, mt);
+// Empty text, allocated the first time and reused after that.
+MText *ClearText(MTextPtr &text) {
+    if (!text) {
+        text.reset(mtext());
+    } else {
+        mtext_del(text.get(), 0, mtext_len(text.get()));
+    }
+    return text.get();
+}
 
-    buf[mconv->nbytes] = '\0';
-    FCITX_M17N_DEBUG() << "MText bytes: " << mconv->nbytes;
-    mconv_free_converter(mconv);
-    return buf.data();
+// The file name of each input method in infos. m17n-db names the file of an
+// input method <language>-<name>.mim, or <name>.mim for the language
+// independent ones, e.g. t:latn-post is in latn-post.mim.
+std::unordered_map<std::string, M17NInputMethodKey>
+InputMethodFiles(const std::vector<M17NInputMethodInfo> &infos) {
+    std::unordered_map<std::string, M17NInputMethodKey> files;
+    for (const auto &info : infos) {
+        auto key = std::make_pair(msymbol(info.language.data()),
+                                  msymbol(info.name.data()));
+        files[stringutils::concat(info.language, "-", info.name, ".mim")] =
+            key;
+        if (info.language == "t") {
+            files[stringutils::concat(info.name, ".mim")] = key;
+        }
+    }
+    return files;
 }
 
 // Don't use this for large indices or (worse) list iteration.
@@ -75,98 +109,6 @@ void *MPListIndex(MPlist *head, size_t idx) {
     return mplist_value(head);
 }
 
-MSymbol KeySymToSymbol(Key key) {
-    /*
-     Rationale:
-
-     This function converts fcitx key symbols to m17n key symbols.
-
-     Both fcitx and m17n uses X symbols to represent basic key events
-     (without modifiers). The conversion of modifier syntax is implemented in
-     this function.
-
-     The formalism provided by fcitx intended for more portable code, like
-     enums such as FCITX_BACKSPACE to represent Backspace key event, macros
-     such as FcitxHotkeyIsHotkey to do comaparision, is largely disregarded
-     here. Similiar situation for libm17n's notion of special keys like
-     msymbol("BackSpace") for Backspace key event.
-
-     MSymbol's don't need to be finalized in any way.
-     */
-
-    MSymbol mkeysym = Mnil;
-    KeyStates mask;
-
-    if (key.sym() >= FcitxKey_Shift_L && key.sym() <= FcitxKey_Hyper_R) {
-        return Mnil;
-    }
-
-    std::string base;
-    char temp[2] = " ";
-
-    if (key.sym() >= FcitxKey_space && key.sym() <= FcitxKey_asciitilde) {
-        KeySym c = key.sym();
-
-        if (key.sym() == FcitxKey_space && key.states().test(KeyState::Shift)) {
-            mask |= KeyState::Shift;
-        }
-
-        if (key.states().test(KeyState::Ctrl)) {
-            if (c >= FcitxKey_a && c <= FcitxKey_z) {
-                c = static_cast<KeySym>(c + FcitxKey_A - FcitxKey_a);
-            }
-            mask |= KeyState::Ctrl;
-        }
-
-        temp[0] = c & 0xff;
-        base = temp;
-    } else {
-        mask |= key.states() & (KeyState::Ctrl_Shift);
-        base = KeySymName(key.sym());
-        if (base.empty()) {
-            return Mnil;
-        }
-    }
-
-    mask |=
-        key.states() & KeyStates{KeyState::Mod1, KeyState::Mod5, KeyState::Meta,
-                                 KeyState::Super, KeyState::Hyper};
-
-    std::string prefix;
-
-    // and we use reverse order here comparing with other implementation since
-    // strcat is append.
-    // I don't know if it matters, but it's just to make sure it works.
-    if (mask & KeyState::Shift) {
-        prefix.append("S-");
-    }
-    if (mask & KeyState::Ctrl) {
-        prefix.append("C-");
-    }
-    if (mask & KeyState::Meta) {
-        prefix.append("M-");
-    }
-    if (mask & KeyState::Alt) {
-        prefix.append("A-");
-    }
-    // This is mysterious. - xiaq
-    if (mask & KeyState::Mod5) {
-        prefix.append("G-");
-    }
-    if (mask & KeyState::Super) {
-        prefix.append("s-");
-    }
-    if (mask & KeyState::Hyper) {
-        prefix.append("H-");
-    }
-
-    std::string keystr = stringutils::concat(prefix, base);
-    FCITX_M17N_DEBUG() << "M17n key str: " << keystr << " " << key;
-    mkeysym = msymbol(keystr.data());
-
-    return mkeysym;
-}
-
 int GetPageSize(MSymbol mlang, MSymbol mname) {
     MPlist *plist =
         minput_get_variable(mlang, mname, msymbol("candidates-group-size"));
@@ -181,11 +123,128 @@ int GetPageSize(MSymbol mlang, MSymbol mname) {
     return reinterpret_cast<intptr_t>(MPListIndex(varinfo, 3));
 }
 
-inline void SetPreedit(InputContext *ic, const std::string &s, int cursor_pos) {
+// Whether one of the maps in the file of the input method binds Up and Down
+// on their own to the previous and next candidate group, ((Up) (select @[))
+// and ((Down) (select @])). Maps of included files are not looked at.
+bool BindsGroupKeys(MSymbol language, MSymbol name) {
+    MDatabase *mdb = mdatabase_find(Minput_method, language, name, Mnil);
+    if (!mdb) {
+        return false;
+    }
+    auto *plist = static_cast<MPlist *>(mdatabase_load(mdb));
+    if (!plist) {
+        return false;
+    }
+    const MSymbol map = msymbol("map");
+    const MSymbol select = msymbol("select");
+    const MSymbol up = msymbol("Up");
+    const MSymbol down = msymbol("Down");
+    const MSymbol previousGroup = msymbol("@[");
+    const MSymbol nextGroup = msymbol("@]");
+    bool bindsUp = false;
+    bool bindsDown = false;
+    // (map (NAME (KEYSEQ ACTION...)...)...)
+    for (MPlist *decl = plist; mplist_key(decl) != Mnil;
+         decl = mplist_next(decl)) {
+        if (mplist_key(decl) != Mplist) {
+            continue;
+        }
+        auto *maps = static_cast<MPlist *>(mplist_value(decl));
+        if (mplist_key(maps) != Msymbol || mplist_value(maps) != map) {
+            continue;
+        }
+        for (maps = mplist_next(maps); mplist_key(maps) != Mnil;
+             maps = mplist_next(maps)) {
+            if (mplist_key(maps) != Mplist) {
+                continue;
+            }
+            auto *rules =
+                mplist_next(static_cast<MPlist *>(mplist_value(maps)));
+            for (; mplist_key(rules) != Mnil; rules = mplist_next(rules)) {
+                if (mplist_key(rules) != Mplist) {
+                    continue;
+                }
+                auto *rule = static_cast<MPlist *>(mplist_value(rules));
+                if (mplist_key(rule) != Mplist) {
+                    continue;
+                }
+                auto *keys = static_cast<MPlist *>(mplist_value(rule));
+                if (mplist_key(keys) != Msymbol || mplist_length(keys) != 1) {
+                    continue;
+                }
+                const auto key = static_cast<MSymbol>(mplist_value(keys));
+                for (MPlist *action = mplist_next(rule);
+                     mplist_key(action) != Mnil; action = mplist_next(action)) {
+                    if (mplist_key(action) != Mplist) {
+                        continue;
+                    }
+                    auto *args = static_cast<MPlist *>(mplist_value(action));
+                    if (mplist_length(args) != 2 ||
+                        mplist_key(args) != Msymbol ||
+                        mplist_value(args) != select ||
+                        mplist_key(mplist_next(args)) != Msymbol) {
+                        continue;
+                    }
+                    const auto target =
+                        static_cast<MSymbol>(mplist_value(mplist_next(args)));
+                    bindsUp = bindsUp || (key == up && target == previousGroup);
+                    bindsDown =
+                        bindsDown || (key == down && target == nextGroup);
+                }
+            }
+        }
+    }
+    m17n_object_unref(plist);
+    return bindsUp && bindsDown;
+}
+
+// Return the number of the group in candidate list head that contains
+// candidate index, or -1 if there is none. The index of the first candidate of
+// that group is stored in start.
+int CandidateGroup(MPlist *head, int index, int *start) {
+    if (index < 0) {
+        return -1;
+    }
+    int i = 0;
+    int group = 0;
+    for (; head && mplist_key(head) != Mnil; head = mplist_next(head)) {
+        int len;
+        if (mplist_key(head) == Mtext) {
+            len = mtext_len(static_cast<MText *>(mplist_value(head)));
+        } else {
+            len = mplist_length(static_cast<MPlist *>(mplist_value(head)));
+        }
+
+        if (i + len > index) {
+            if (start) {
+                *start = i;
+            }
+            return group;
+        }
+
+        i += len;
+        group++;
+    }
+    return -1;
+}
+
+inline void SetPreedit(InputContext *ic, const M17NPreedit &s) {
     Text preedit;
-    preedit.append(s, TextFormatFlag::Underline);
-    if (cursor_pos >= 0 && utf8::length(s) >= static_cast<size_t>(cursor_pos)) {
-        preedit.setCursor(utf8::ncharByteLength(s.begin(), cursor_pos));
+    if (s.segmentBegin >= 0) {
+        // The part m17n shows candidates for.
+        const std::string_view text = s.text;
+        preedit.append(std::string(text.substr(0, s.segmentBegin)),
+                       TextFormatFlag::Underline);
+        preedit.append(std::string(text.substr(s.segmentBegin,
+                                               s.segmentEnd - s.segmentBegin)),
+                       {TextFormatFlag::Underline, TextFormatFlag::HighLight});
+        preedit.append(std::string(text.substr(s.segmentEnd)),
+                       TextFormatFlag::Underline);
+    } else {
+        preedit.append(s.text, TextFormatFlag::Underline);
+    }
+    if (s.cursor >= 0) {
+        preedit.setCursor(s.cursor);
     }
 
     if (ic->capabilityFlags().test(CapabilityFlag::Preedit)) {
@@ -211,55 +270,92 @@ private:
     int index_;
 };
 
-class M17NCandidateList : public CommonCandidateList {
+// Only the candidates on the visible page are converted to UTF-8, the rest
+// are converted on demand. Large candidate sets (e.g. Pinyin or Hanja) then
+// cost one page of conversion per update instead of the whole list.
+class M17NCandidateList : public CandidateList,
+                          public PageableCandidateList,
+                          public CursorMovableCandidateList,
+                          public BulkCandidateList {
 public:
     M17NCandidateList(M17NEngine *engine, InputContext *ic)
         : engine_(engine), ic_(ic) {
+        setPageable(this);
+        setCursorMovable(this);
+        setBulk(this);
+
         auto *state = ic_->propertyFor(engine_->factory());
-        auto pageSize = GetPageSize(state->mim()->language, state->mim()->name);
-
-        const static KeyList selectionKeys{
-            Key(FcitxKey_1), Key(FcitxKey_2), Key(FcitxKey_3), Key(FcitxKey_4),
-            Key(FcitxKey_5), Key(FcitxKey_6), Key(FcitxKey_7), Key(FcitxKey_8),
-            Key(FcitxKey_9), Key(FcitxKey_0)};
-        setPageSize(pageSize);
-        setSelectionKey(selectionKeys);
-        MPlist *head = state->mic()->candidate_list;
+        pageSize_ =
+            engine_->pageSize(state->mim()->language, state->mim()->name);
+
+        // Keep the list alive in case a word is requested after m17n moved on
+        // to a new candidate list.
+        candidates_ = state->mic()->candidate_list;
+        m17n_object_ref(candidates_);
+
+        // Only record where each group starts, nothing is converted here.
+        MPlist *head = candidates_;
         int index = 0;
         for (; head && mplist_key(head) != Mnil; head = mplist_next(head)) {
             MSymbol key = mplist_key(head);
+            int length;
             if (key == Mplist) {
-                MPlist *head2 = static_cast<MPlist *>(mplist_value(head));
-                for (; head2 && mplist_key(head2) != Mnil;
-                     head2 = mplist_next(head2)) {
-                    MText *word = static_cast<MText *>(mplist_value(head2));
-                    // Fcitx will do the free() for us.
-                    auto str = MTextToUTF8(word);
-                    append<M17NCandidateWord>(engine_, str, index);
-                    index++;
-                }
+                length =
+                    mplist_length(static_cast<MPlist *>(mplist_value(head)));
             } else if (key == Mtext) {
-                auto words =
-                    MTextToUTF8(static_cast<MText *>(mplist_value(head)));
-                auto range = utf8::MakeUTF8CharRange(words);
-                for (auto p = std::begin(range), q = std::end(range); p != q;
-                     ++p) {
-                    auto charRange = p.charRange();
-                    std::string str(charRange.first, charRange.second);
-                    append<M17NCandidateWord>(engine_, str, index);
-                    index++;
-                }
+                length = mtext_len(static_cast<MText *>(mplist_value(head)));
             } else {
                 FCITX_M17N_DEBUG() << "Invalid MSymbol: " << msymbol_name(key);
+                continue;
             }
+            groups_.push_back({head, index});
+            index += length;
         }
+        words_.resize(index);
+
         if (state->mic()->candidate_index >= 0 &&
             state->mic()->candidate_index < totalSize()) {
-            setGlobalCursorIndex(state->mic()->candidate_index);
-            setPage(state->mic()->candidate_index / pageSize);
+            cursor_ = state->mic()->candidate_index;
+            page_ = cursor_ / pageSize_;
+        }
+    }
+
+    ~M17NCandidateList() override { m17n_object_unref(candidates_); }
+
+    const Text &label(int idx) const override {
+        checkIndex(idx);
+        const auto &labels = Labels();
+        if (static_cast<size_t>(idx) < labels.size()) {
+            return labels[idx];
+        }
+        static const Text emptyLabel;
+        return emptyLabel;
+    }
+
+    const CandidateWord &candidate(int idx) const override {
+        checkIndex(idx);
+        return word(page_ * pageSize_ + idx);
+    }
+
+    int size() const override {
+        return std::min(pageSize_, totalSize() - page_ * pageSize_);
+    }
+
+    int cursorIndex() const override {
+        if (cursor_ >= page_ * pageSize_ && cursor_ < (page_ + 1) * pageSize_) {
+            return cursor_ - page_ * pageSize_;
         }
+        return -1;
+    }
+
+    CandidateLayoutHint layoutHint() const override {
+        return CandidateLayoutHint::NotSet;
     }
 
+    bool hasPrev() const override { return page_ > 0; }
+
+    bool hasNext() const override { return page_ + 1 < totalPages(); }
+
     void prev() override {
         auto *state = ic_->propertyFor(engine_->factory());
         state->keyEvent(Key(FcitxKey_Up));
@@ -272,6 +368,18 @@ public:
 
     bool usedNextBefore() const override { return true; }
 
+    int totalPages() const override {
+        return (totalSize() + pageSize_ - 1) / pageSize_;
+    }
+
+    int currentPage() const override { return page_; }
+
+    void setPage(int page) override {
+        if (page >= 0 && page < totalPages()) {
+            page_ = page;
+        }
+    }
+
     void prevCandidate() override {
         auto *state = ic_->propertyFor(engine_->factory());
         state->keyEvent(Key(FcitxKey_Left));
@@ -282,9 +390,78 @@ public:
         state->keyEvent(Key(FcitxKey_Right));
     }
 
+    const CandidateWord &candidateFromAll(int idx) const override {
+        if (idx < 0 || idx >= totalSize()) {
+            throw std::invalid_argument("M17NCandidateList: invalid index");
+        }
+        return word(idx);
+    }
+
+    int totalSize() const override { return static_cast<int>(words_.size()); }
+
 private:
+    struct Group {
+        MPlist *head;
+        int start;
+    };
+
+    static const std::vector<Text> &Labels() {
+        static const std::vector<Text> labels = []() {
+            const KeySym selectionKeys[] = {
+                FcitxKey_1, FcitxKey_2, FcitxKey_3, FcitxKey_4, FcitxKey_5,
+                FcitxKey_6, FcitxKey_7, FcitxKey_8, FcitxKey_9, FcitxKey_0};
+            std::vector<Text> result;
+            for (auto sym : selectionKeys) {
+                result.emplace_back(
+                    stringutils::concat(Key::keySymToUTF8(sym), ". "));
+            }
+            return result;
+        }();
+        return labels;
+    }
+
+    void checkIndex(int idx) const {
+        if (idx < 0 || idx >= size()) {
+            throw std::invalid_argument("M17NCandidateList: invalid index");
+        }
+    }
+
+    const M17NCandidateWord &word(int idx) const {
+        auto &slot = words_[idx];
+        if (!slot) {
+            slot = std::make_unique<M17NCandidateWord>(engine_, wordText(idx),
+                                                       idx);
+        }
+        return *slot;
+    }
+
+    std::string wordText(int idx) const {
+        auto iter = std::upper_bound(
+            groups_.begin(), groups_.end(), idx,
+            [](int value, const Group &group) { return value < group.start; });
+        const auto &group = *std::prev(iter);
+        const int offset = idx - group.start;
+        std::string text;
+        if (mplist_key(group.head) == Mplist) {
+            MText *word = static_cast<MText *>(MPListIndex(
+                static_cast<MPlist *>(mplist_value(group.head)), offset));
+            engine_->converter().convert(word, text);
+        } else {
+            // Each character of a Mtext group is a candidate on its own.
+            text = utf8::UCS4ToUTF8(mtext_ref_char(
+                static_cast<MText *>(mplist_value(group.head)), offset));
+        }
+        return text;
+    }
+
     M17NEngine *engine_;
     InputContext *ic_;
+    MPlist *candidates_ = nullptr;
+    std::vector<Group> groups_;
+    mutable std::vector<std::unique_ptr<M17NCandidateWord>> words_;
+    int pageSize_ = 1;
+    int page_ = 0;
+    int cursor_ = -1;
 };
 
 } // namespace
@@ -295,17 +472,312 @@ M17NEngine::M17NEngine(Instance *instance)
     reloadConfig();
     M17N_INIT();
 
+    overridePath_ = StandardPaths::global()
+                        .locate(StandardPathsType::PkgData, "m17n/default")
+                        .string();
     auto file = StandardPaths::global().open(StandardPathsType::PkgData,
                                              "m17n/default");
     if (file.isValid()) {
         list_ = ParseDefaultSettings(file.fd());
     }
 
+    poolTimer_ = instance_->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + PooledContextTimeout, 0,
+        [this](EventSourceTime *, uint64_t) {
+            trimContextPools();
+            return true;
+        });
+    poolTimer_->setEnabled(false);
+    idleTimer_ = instance_->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + IdleCheckInterval, 0,
+        [this](EventSourceTime *, uint64_t) {
+            evictStates(nullptr);
+            return true;
+        });
+    idleTimer_->setEnabled(false);
+
+    watcher_ = std::make_unique<DirectoryWatcher>(
+        &instance_->eventLoop(),
+        [this](const std::unordered_set<std::string> &paths) {
+            databaseChanged(paths);
+        });
+    for (const auto &directory : M17NDatabaseDirectories()) {
+        watcher_->addDirectory(directory);
+    }
+    if (!overridePath_.empty()) {
+        watcher_->addDirectory(
+            std::filesystem::path(overridePath_).parent_path().string());
+    }
+
+    // Load the input methods used most in earlier sessions once the event
+    // loop is idle, so that their first key does not pay for it.
+    std::vector<M17NUsage> used;
+    for (auto &item : LoadUsage()) {
+        auto key = std::make_pair(msymbol(item.language.data()),
+                                  msymbol(item.name.data()));
+        if (item.keys > 0) {
+            used.push_back(item);
+        }
+        usage_[key] = std::move(item);
+    }
+    for (const auto &item : MostUsed(std::move(used), *config_.prewarmCount)) {
+        prewarmQueue_.emplace_back(msymbol(item.language.data()),
+                                   msymbol(item.name.data()));
+    }
+    if (!prewarmQueue_.empty()) {
+        prewarmEvent_ =
+            instance_->eventLoop().addDeferEvent([this](EventSource *source) {
+                if (prewarmNext()) {
+                    source->setOneShot();
+                }
+                return true;
+            });
+        prewarmEvent_->setOneShot();
+    }
+
     instance_->inputContextManager().registerProperty("m17nState", &factory_);
 }
 
+void M17NEngine::save() {
+    std::vector<M17NUsage> usage;
+    usage.reserve(usage_.size());
+    for (const auto &[key, item] : usage_) {
+        if (item.keys > 0) {
+            usage.push_back(item);
+        }
+    }
+    if (!SaveUsage(usage)) {
+        FCITX_M17N_WARN() << "Failed to save input method usage.";
+    }
+}
+
+M17NUsage &M17NEngine::usage(MSymbol language, MSymbol name) {
+    auto [iter, inserted] = usage_.try_emplace(std::make_pair(language, name));
+    if (inserted) {
+        iter->second.language = msymbol_name(language);
+        iter->second.name = msymbol_name(name);
+    }
+    return iter->second;
+}
+
+bool M17NEngine::prewarmNext() {
+    const size_t budget = static_cast<size_t>(*config_.prewarmBudget) * 1024;
+    while (!prewarmQueue_.empty()) {
+        const auto key = prewarmQueue_.front();
+        prewarmQueue_.erase(prewarmQueue_.begin());
+        if (inputMethods_.count(key)) {
+            continue;
+        }
+        if (budget && prewarmBytes_ >= budget) {
+            FCITX_M17N_DEBUG() << "Prewarm budget of " << budget
+                               << " bytes used up";
+            prewarmQueue_.clear();
+            break;
+        }
+        // The size is only known afterwards, so the last input method may
+        // go over the budget.
+        const size_t before = HeapInUse();
+        inputMethod(key.first, key.second);
+        const size_t after = HeapInUse();
+        if (after > before) {
+            prewarmBytes_ += after - before;
+        }
+        FCITX_M17N_DEBUG() << "Prewarmed IM [" << msymbol_name(key.first)
+                           << ": " << msymbol_name(key.second) << "], "
+                           << prewarmBytes_ << " bytes in total";
+        return !prewarmQueue_.empty();
+    }
+    return false;
+}
+
 std::vector<InputMethodEntry> M17NEngine::listInputMethods() {
+    // infos_ is already up to date when the engine itself asked for the
+    // refresh, otherwise e.g. the user reloads fcitx and the database may
+    // have changed without the watcher noticing.
+    if (!refreshing_) {
+        const auto stamp = M17NDatabaseStamp(overridePath_);
+        if (auto cached = LoadInputMethodListCache(stamp)) {
+            FCITX_M17N_DEBUG() << "Loaded " << cached->size()
+                               << " input methods from cache";
+            infos_ = std::move(*cached);
+        } else {
+            infos_ = enumerateInputMethods();
+            if (!SaveInputMethodListCache(stamp, infos_)) {
+                FCITX_M17N_WARN()
+                    << "Failed to save input method list cache.";
+            }
+        }
+    }
+
     std::vector<InputMethodEntry> entries;
+    for (const auto &info : infos_) {
+        if (info.deprecated && !*config_.enableDeprecated) {
+            continue;
+        }
+        entries.push_back(makeEntry(info));
+    }
+    return entries;
+}
+
+InputMethodEntry
+M17NEngine::makeEntry(const M17NInputMethodInfo &info) const {
+    auto uniqueName =
+        stringutils::concat("m17n_", info.language, "_", info.name);
+    const std::string i18nname =
+        info.i18nName.size() ? _(info.i18nName) : info.name;
+    auto fxName = _("{0} (M17N)", i18nname);
+    const std::string &iconName = info.icon.empty() ? uniqueName : info.icon;
+
+    InputMethodEntry entry(uniqueName, fxName,
+                           (info.language == "t" ? "mul" : info.language),
+                           "m17n");
+    entry.setConfigurable(true).setIcon(iconName);
+    entry.setUserData(std::make_unique<M17NData>(
+        msymbol(info.language.data()), msymbol(info.name.data())));
+    return entry;
+}
+
+void M17NEngine::configChanged(bool enableDeprecated) {
+    evictStates(nullptr);
+    if (enableDeprecated == *config_.enableDeprecated || infos_.empty()) {
+        return;
+    }
+    if (*config_.enableDeprecated) {
+        // Only the deprecated entries are new to the input method manager,
+        // and they are listed from infos_ without touching m17n-db.
+        FCITX_M17N_DEBUG() << "Adding deprecated input methods";
+        refreshing_ = true;
+        instance_->inputMethodManager().refresh();
+        refreshing_ = false;
+        return;
+    }
+    // The input method manager has no way to remove single entries, they stay
+    // listed until restart, but nothing of them is kept in the engine.
+    for (const auto &info : infos_) {
+        if (info.deprecated) {
+            forgetInputMethod(std::make_pair(msymbol(info.language.data()),
+                                             msymbol(info.name.data())));
+        }
+    }
+}
+
+void M17NEngine::databaseChanged(
+    const std::unordered_set<std::string> &paths) {
+    const bool overrideChanged = paths.count(overridePath_);
+    if (overrideChanged) {
+        FCITX_M17N_DEBUG() << "Reloading " << overridePath_;
+        list_ = OverrideTable();
+        auto file = StandardPaths::global().open(StandardPathsType::PkgData,
+                                                 "m17n/default");
+        if (file.isValid()) {
+            list_ = ParseDefaultSettings(file.fd());
+        }
+    }
+
+    const auto files = InputMethodFiles(infos_);
+    const auto directories = M17NDatabaseDirectories();
+    std::unordered_set<M17NInputMethodKey, M17NInputMethodKeyHash> touched;
+    std::vector<std::string> unknownFiles;
+    for (const auto &path : paths) {
+        const std::filesystem::path file(path);
+        if (std::find(directories.begin(), directories.end(),
+                      file.parent_path().string()) == directories.end()) {
+            // E.g. the input method list cache next to the override file.
+            continue;
+        }
+        if (auto iter = files.find(file.filename().string());
+            iter != files.end()) {
+            // Nothing is kept for an input method that was never opened.
+            if (inputMethods_.count(iter->second)) {
+                touched.insert(iter->second);
+            }
+        } else {
+            // A new input method, one with an unusual file name or a file
+            // included by input methods.
+            unknownFiles.push_back(file.filename().string());
+        }
+    }
+    if (!overrideChanged && touched.empty() && unknownFiles.empty()) {
+        return;
+    }
+
+    // Only the list is enumerated again, input methods are opened lazily.
+    auto infos = enumerateInputMethods();
+    if (!SaveInputMethodListCache(M17NDatabaseStamp(overridePath_), infos)) {
+        FCITX_M17N_WARN() << "Failed to save input method list cache.";
+    }
+    std::unordered_set<std::string> oldNames;
+    for (const auto &info : infos_) {
+        oldNames.insert(stringutils::concat(info.language, "_", info.name));
+    }
+    bool added = false;
+    for (const auto &info : infos) {
+        if (!oldNames.erase(
+                stringutils::concat(info.language, "_", info.name))) {
+            FCITX_M17N_DEBUG() << "New input method [" << info.language
+                               << ": " << info.name << "]";
+            added = true;
+        }
+    }
+    // Whatever is left has been removed. The input method manager has no way
+    // to remove a single entry, but the engine stops using it.
+    for (const auto &info : infos_) {
+        if (oldNames.count(stringutils::concat(info.language, "_",
+                                               info.name))) {
+            FCITX_M17N_DEBUG() << "Removed input method [" << info.language
+                               << ": " << info.name << "]";
+            touched.insert(std::make_pair(msymbol(info.language.data()),
+                                          msymbol(info.name.data())));
+        }
+    }
+    // The file of a new input method only adds it.
+    const auto newFiles = InputMethodFiles(infos);
+    infos_ = std::move(infos);
+
+    if (std::any_of(unknownFiles.begin(), unknownFiles.end(),
+                    [&newFiles](const std::string &file) {
+                        return !newFiles.count(file);
+                    })) {
+        // Can't tell which input method it belongs to.
+        for (const auto &[key, mim] : inputMethods_) {
+            touched.insert(key);
+        }
+    }
+    for (const auto &key : touched) {
+        forgetInputMethod(key);
+    }
+    if (added) {
+        // Only picks up the new entries, listed from infos_.
+        refreshing_ = true;
+        instance_->inputMethodManager().refresh();
+        refreshing_ = false;
+    }
+}
+
+void M17NEngine::forgetInputMethod(const M17NInputMethodKey &key) {
+    FCITX_M17N_DEBUG() << "Forget IM [" << msymbol_name(key.first) << ": "
+                       << msymbol_name(key.second) << "]";
+    // evict() changes liveStates_.
+    std::vector<M17NState *> states;
+    for (auto *state : liveStates_) {
+        if (state->mim() && state->mim()->language == key.first &&
+            state->mim()->name == key.second) {
+            states.push_back(state);
+        }
+    }
+    for (auto *state : states) {
+        if (state->busy()) {
+            state->reset();
+        }
+        state->evict();
+    }
+    contextPools_.erase(key);
+    inputMethods_.erase(key);
+    variables_.erase(key);
+}
+
+std::vector<M17NInputMethodInfo> M17NEngine::enumerateInputMethods() {
+    std::vector<M17NInputMethodInfo> infos;
     MPlist *mimlist = minput_list(Mnil);
     auto imLength = mplist_length(mimlist);
     for (int i = 0; i < imLength; i++, mimlist = mplist_next(mimlist)) {
@@ -319,38 +791,31 @@ std::vector<InputMethodEntry> M17NEngine::listInputMethods() {
         char *lang = msymbol_name(mlang);
         char *name = msymbol_name(mname);
 
-        const OverrideItem *item = nullptr;
-        if (list_.size()) {
-            item = MatchDefaultSettings(list_, lang, name);
-        }
-
-        if (item && item->priority < 0 && !*config_.enableDeprecated) {
-            continue;
-        }
-
         if (msane != Mt) {
             // Not "sane"
             FCITX_M17N_WARN() << "Insane IM [" << lang << ": " << name << "]";
             continue;
         }
 
-        MPlist *l =
-            minput_get_variable(mlang, mname, msymbol("candidates-charset"));
-        if (l) {
-            /* XXX Non-utf8 encodings are ditched. */
-            if (((MSymbol)MPListIndex(static_cast<MPlist *>(mplist_value(l)),
-                                      3)) != Mcoding_utf_8) {
-                continue;
-            }
+        /* XXX Non-utf8 encodings are ditched. */
+        MSymbol charset = candidatesCharset(mlang, mname);
+        if (charset != Mnil && charset != Mcoding_utf_8) {
+            continue;
         }
 
         FCITX_M17N_DEBUG() << "Created IM [" << lang << ": " << name << "]";
 
-        std::string iconName;
-        auto uniqueName = stringutils::concat("m17n_", lang, "_", name);
-        const std::string i18nname =
-            (item && item->i18nName.size()) ? _(item->i18nName) : name;
-        auto fxName = _("{0} (M17N)", i18nname);
+        auto &result = infos.emplace_back();
+        result.language = lang;
+        result.name = name;
+
+        if (!list_.empty()) {
+            if (const auto *item = MatchDefaultSettings(list_, lang, name)) {
+                result.priority = item->priority;
+                result.deprecated = item->priority < 0;
+                result.i18nName = item->i18nName;
+            }
+        }
 
         info = minput_get_title_icon(mlang, mname);
         // head of info is a MText
@@ -362,25 +827,351 @@ std::vector<InputMethodEntry> M17NEngine::listInputMethods() {
             // path almost always consists of ascii characters (typically
             // /usr/share/m17n/icons/... on Linux systems, this is a
             // reasonable assumption.
-            iconName = MTextToUTF8(iconPath);
-            FCITX_M17N_DEBUG() << "Mim icon is " << iconName;
-        } else {
-            iconName = uniqueName;
+            converter_.convert(iconPath, result.icon);
+            FCITX_M17N_DEBUG() << "Mim icon is " << result.icon;
         }
         m17n_object_unref(info);
-
-        InputMethodEntry entry(uniqueName, fxName,
-                               (strcmp(lang, "t") == 0 ? "mul" : lang), "m17n");
-        entry.setConfigurable(true).setIcon(iconName);
-        entry.setUserData(std::make_unique<M17NData>(mlang, mname));
-        entries.emplace_back(std::move(entry));
     }
     m17n_object_unref(mimlist);
-    return entries;
+    return infos;
+}
+
+std::shared_ptr<MInputMethod> M17NEngine::inputMethod(MSymbol language,
+                                                      MSymbol name) {
+    auto key = std::make_pair(language, name);
+    if (auto iter = inputMethods_.find(key); iter != inputMethods_.end()) {
+        return iter->second;
+    }
+
+    MInputMethod *mim;
+    // Only input methods that could be opened get an entry in stats_.
+    M17NSpanStats open;
+    {
+        SpanTimer timer(&open);
+        mim = minput_open_im(language, name, nullptr);
+    }
+    if (!mim) {
+        FCITX_M17N_WARN() << "Failed to open IM [" << msymbol_name(language)
+                          << ": " << msymbol_name(name) << "]";
+        return nullptr;
+    }
+    auto &stats = inputMethodStats(language, name).openInputMethod;
+    stats.count += open.count;
+    stats.totalNs += open.totalNs;
+    stats.maxNs = std::max(stats.maxNs, open.maxNs);
+    FCITX_M17N_DEBUG() << "Opened IM [" << msymbol_name(language) << ": "
+                       << msymbol_name(name) << "]";
+
+    // The callback list belongs to the MInputMethod, so it only needs to be
+    // set up once. The callback finds its M17NState through context->arg.
+    mplist_put(mim->driver.callback_list, Minput_get_surrounding_text,
+               reinterpret_cast<void *>(&M17NState::callback));
+    mplist_put(mim->driver.callback_list, Minput_delete_surrounding_text,
+               reinterpret_cast<void *>(&M17NState::callback));
+
+    auto &result = inputMethods_[key];
+    result.reset(mim, &minput_close_im);
+    return result;
+}
+
+M17NInputContextPtr
+M17NEngine::acquireContext(const std::shared_ptr<MInputMethod> &mim,
+                           M17NState *state) {
+    auto &stats = inputMethodStats(mim->language, mim->name);
+    SpanTimer timer(&stats.acquireContext);
+    M17NInputContextPtr mic(nullptr, &minput_destroy_ic);
+    auto key = std::make_pair(mim->language, mim->name);
+    if (auto iter = contextPools_.find(key);
+        iter != contextPools_.end() && iter->second.mim == mim &&
+        !iter->second.contexts.empty()) {
+        // The most recently used one, it is most likely still in cache.
+        mic = std::move(iter->second.contexts.back().mic);
+        iter->second.contexts.pop_back();
+    } else {
+        SpanTimer createTimer(&stats.createInputContext);
+        mic.reset(minput_create_ic(mim.get(), state));
+    }
+    if (mic) {
+        mic->arg = state;
+    }
+    return mic;
+}
+
+void M17NEngine::releaseContext(const std::shared_ptr<MInputMethod> &mim,
+                                M17NInputContextPtr mic) {
+    if (!mic) {
+        return;
+    }
+    minput_reset_ic(mic.get());
+    mic->arg = nullptr;
+    auto &pool = contextPools_[std::make_pair(mim->language, mim->name)];
+    if (pool.mim != mim) {
+        // The input method was reopened, contexts of the old one are useless.
+        pool.contexts.clear();
+        pool.mim = mim;
+    }
+    if (pool.contexts.size() >= MaxPooledContexts) {
+        return;
+    }
+    pool.contexts.push_back({std::move(mic), now(CLOCK_MONOTONIC)});
+    if (!poolTimer_->isEnabled()) {
+        poolTimer_->setNextInterval(PooledContextTimeout);
+        poolTimer_->setOneShot();
+    }
+}
+
+void M17NEngine::trimContextPools() {
+    const uint64_t current = now(CLOCK_MONOTONIC);
+    for (auto iter = contextPools_.begin(); iter != contextPools_.end();) {
+        auto &contexts = iter->second.contexts;
+        // Contexts are appended in release order, so the oldest come first.
+        auto end = std::find_if(contexts.begin(), contexts.end(),
+                                [current](const auto &entry) {
+                                    return entry.idleSince +
+                                               PooledContextTimeout >
+                                           current;
+                                });
+        contexts.erase(contexts.begin(), end);
+        if (contexts.empty()) {
+            iter = contextPools_.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    if (!contextPools_.empty()) {
+        poolTimer_->setNextInterval(PooledContextTimeout);
+        poolTimer_->setOneShot();
+    }
+}
+
+void M17NEngine::touchState(M17NState *state) {
+    state->lastUsed_ = now(CLOCK_MONOTONIC);
+    if (state->lruEntry_) {
+        liveStates_.splice(liveStates_.begin(), liveStates_,
+                           *state->lruEntry_);
+        return;
+    }
+    state->lruEntry_ = liveStates_.insert(liveStates_.begin(), state);
+    if (liveStates_.size() > static_cast<size_t>(*config_.maxContexts)) {
+        evictStates(state);
+    }
+    if (*config_.idleTimeout > 0 && !idleTimer_->isEnabled()) {
+        idleTimer_->setNextInterval(IdleCheckInterval);
+        idleTimer_->setOneShot();
+    }
 }
 
-void M17NEngine::activate(const InputMethodEntry & /*entry*/,
-                          InputContextEvent & /*event*/) {}
+void M17NEngine::removeState(M17NState *state) {
+    if (state->lruEntry_) {
+        liveStates_.erase(*state->lruEntry_);
+        state->lruEntry_.reset();
+    }
+}
+
+void M17NEngine::evictStates(M17NState *keep) {
+    const size_t maxContexts = *config_.maxContexts;
+    const uint64_t idleTimeout =
+        static_cast<uint64_t>(*config_.idleTimeout) * 60 * 1000000ULL;
+    const uint64_t current = now(CLOCK_MONOTONIC);
+    // Least recently used first. evict() removes the state before iter from
+    // the list, which leaves iter valid.
+    for (auto iter = liveStates_.end(); iter != liveStates_.begin();) {
+        auto *state = *std::prev(iter);
+        const bool overLimit = liveStates_.size() > maxContexts;
+        const bool idle =
+            idleTimeout && state->lastUsed_ + idleTimeout <= current;
+        if (!overLimit && !idle) {
+            // The rest is used more recently.
+            break;
+        }
+        if (state == keep || state->busy()) {
+            --iter;
+            continue;
+        }
+        state->evict();
+    }
+    if (idleTimeout && !liveStates_.empty()) {
+        idleTimer_->setNextInterval(IdleCheckInterval);
+        idleTimer_->setOneShot();
+    }
+}
+
+std::optional<M17NInputMethodKey>
+M17NEngine::listedInputMethod(std::string_view uniqueName) const {
+    // Inverse of the unique name built in makeEntry(),
+    // m17n_<language>_<name>. Only names of listed input methods are turned
+    // into symbols, msymbol() keeps every symbol forever.
+    constexpr std::string_view prefix = "m17n_";
+    if (!stringutils::startsWith(uniqueName, prefix)) {
+        return std::nullopt;
+    }
+    uniqueName.remove_prefix(prefix.size());
+    for (const auto &info : infos_) {
+        if (info.deprecated && !*config_.enableDeprecated) {
+            continue;
+        }
+        if (uniqueName.size() == info.language.size() + 1 + info.name.size() &&
+            stringutils::startsWith(uniqueName, info.language) &&
+            uniqueName[info.language.size()] == '_' &&
+            stringutils::endsWith(uniqueName, info.name)) {
+            return std::make_pair(msymbol(info.language.data()),
+                                  msymbol(info.name.data()));
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string>
+M17NEngine::transliterateKeys(const std::string &uniqueName,
+                              const std::vector<Key> &keys) {
+    auto key = listedInputMethod(uniqueName);
+    if (!key) {
+        return std::nullopt;
+    }
+    auto mim = inputMethod(key->first, key->second);
+    if (!mim) {
+        return std::nullopt;
+    }
+    auto mic = acquireContext(mim, nullptr);
+    if (!mic) {
+        return std::nullopt;
+    }
+
+    std::string result;
+    MText *produced = mtext();
+    // Same as M17NState::handleKey(), minus the UI.
+    auto feed = [this, &mic, &result, produced](MSymbol msym) {
+        if (minput_filter(mic.get(), msym, nullptr)) {
+            return true;
+        }
+        mtext_del(produced, 0, mtext_len(produced));
+        const int thru = minput_lookup(mic.get(), msym, nullptr, produced);
+        if (mtext_len(produced) > 0) {
+            result.append(converter_.convert(produced));
+        }
+        return !thru;
+    };
+    for (const auto &key : keys) {
+        MSymbol msym = keySymbol(key);
+        if (msym == Mnil || !feed(msym)) {
+            result.append(Key::keySymToUTF8(key.sym()));
+        }
+    }
+    // Commit the remaining preedit, like M17NState::commitPreedit().
+    feed(Mnil);
+    if (mic->preedit && mtext_len(mic->preedit) > 0) {
+        result.append(converter_.convert(mic->preedit));
+    }
+    m17n_object_unref(produced);
+
+    releaseContext(mim, std::move(mic));
+    return result;
+}
+
+std::optional<std::string> M17NEngine::transliterate(
+    const std::string &uniqueName, const std::string &text) {
+    if (!utf8::validate(text)) {
+        return std::nullopt;
+    }
+    std::vector<Key> keys;
+    keys.reserve(text.size());
+    for (uint32_t chr : utf8::MakeUTF8CharRange(text)) {
+        keys.emplace_back(Key::keySymFromUnicode(chr));
+    }
+    return transliterateKeys(uniqueName, keys);
+}
+
+M17NVariables &M17NEngine::variables(MSymbol language, MSymbol name) {
+    return variables_[std::make_pair(language, name)];
+}
+
+M17NInputMethodStats &M17NEngine::inputMethodStats(MSymbol language,
+                                                   MSymbol name) {
+    auto [iter, inserted] = stats_.try_emplace(std::make_pair(language, name));
+    if (inserted) {
+        iter->second.uniqueName = stringutils::concat(
+            "m17n_", msymbol_name(language), "_", msymbol_name(name));
+    }
+    return iter->second;
+}
+
+std::vector<M17NInputMethodStats> M17NEngine::statistics() const {
+    std::vector<M17NInputMethodStats> result;
+    result.reserve(stats_.size());
+    for (const auto &[key, stats] : stats_) {
+        auto &item = result.emplace_back(stats);
+        for (const auto *state : liveStates_) {
+            if (state->mim() && state->mim()->language == key.first &&
+                state->mim()->name == key.second) {
+                item.liveContexts++;
+            }
+        }
+        if (auto iter = contextPools_.find(key); iter != contextPools_.end()) {
+            item.pooledContexts = iter->second.contexts.size();
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const auto &a, const auto &b) {
+        return a.uniqueName < b.uniqueName;
+    });
+    return result;
+}
+
+void M17NEngine::resetStatistics() {
+    // Keep the entries, M17NState holds pointers to them.
+    for (auto &[key, stats] : stats_) {
+        auto uniqueName = std::move(stats.uniqueName);
+        stats = M17NInputMethodStats();
+        stats.uniqueName = std::move(uniqueName);
+    }
+}
+
+int M17NEngine::pageSize(MSymbol language, MSymbol name) {
+    auto &vars = variables(language, name);
+    if (!vars.pageSize) {
+        vars.pageSize = std::max(1, GetPageSize(language, name));
+    }
+    return *vars.pageSize;
+}
+
+bool M17NEngine::bindsGroupKeys(MSymbol language, MSymbol name) {
+    auto &vars = variables(language, name);
+    if (!vars.bindsGroupKeys) {
+        vars.bindsGroupKeys = BindsGroupKeys(language, name);
+    }
+    return *vars.bindsGroupKeys;
+}
+
+MSymbol M17NEngine::candidatesCharset(MSymbol language, MSymbol name) {
+    auto &vars = variables(language, name);
+    if (!vars.candidatesCharset) {
+        vars.candidatesCharset = Mnil;
+        MPlist *l =
+            minput_get_variable(language, name, msymbol("candidates-charset"));
+        if (l) {
+            vars.candidatesCharset = static_cast<MSymbol>(
+                MPListIndex(static_cast<MPlist *>(mplist_value(l)), 3));
+        }
+    }
+    return *vars.candidatesCharset;
+}
+
+void M17NEngine::activate(const InputMethodEntry &entry,
+                          InputContextEvent &event) {
+    // Opening a large input method takes long enough to notice, do it when
+    // the event loop is idle instead of on the first key or during focus
+    // handling. A key that arrives earlier prepares the state itself.
+    const auto *data = static_cast<const M17NData *>(entry.userData());
+    instance_->eventDispatcher().schedule(
+        [this, ref = event.inputContext()->watch(),
+         uniqueName = entry.uniqueName(), language = data->language(),
+         name = data->name()]() {
+            auto *ic = ref.get();
+            if (!ic || instance_->inputMethod(ic) != uniqueName) {
+                return;
+            }
+            ic->propertyFor(&factory_)->prepare(language, name);
+        });
+}
 
 void M17NEngine::deactivate(const InputMethodEntry & /*entry*/,
                             InputContextEvent &event) {
@@ -410,81 +1201,254 @@ void M17NEngine::reset(const InputMethodEntry & /*entry*/,
     state->reset();
 }
 
-void M17NEngine::reloadConfig() { readAsIni(config_, "conf/m17n.conf"); }
+std::string M17NEngine::subMode(const InputMethodEntry &entry,
+                                InputContext &inputContext) {
+    return status(entry, inputContext);
+}
+
+std::string M17NEngine::subModeLabelImpl(const InputMethodEntry &entry,
+                                         InputContext &inputContext) {
+    return status(entry, inputContext);
+}
+
+std::string M17NEngine::status(const InputMethodEntry &entry,
+                               InputContext &inputContext) {
+    const auto *data = static_cast<const M17NData *>(entry.userData());
+    const auto *state = inputContext.propertyFor(&factory_);
+    // The state may still belong to the previous input method until the
+    // activation is done.
+    if (!state->mim() || state->mim()->language != data->language() ||
+        state->mim()->name != data->name()) {
+        return {};
+    }
+    return state->status();
+}
+
+void M17NEngine::reloadConfig() {
+    const bool enableDeprecated = *config_.enableDeprecated;
+    readAsIni(config_, "conf/m17n.conf");
+    // Pick up changes of the m17n variables, e.g. from ~/.m17n.d/config.mic.
+    variables_.clear();
+    configChanged(enableDeprecated);
+}
 
 void M17NState::callback(MInputContext *context, MSymbol command) {
+    // m17n shares the callback list between all input methods, so this is
+    // also reached from contexts that are not created by M17NState.
     M17NState *state = static_cast<M17NState *>(context->arg);
+    if (!state) {
+        return;
+    }
     state->command(context, command);
 }
 
-void M17NState::command(MInputContext *context, MSymbol command) const {
+void M17NState::command(MInputContext *context, MSymbol command) {
+    const bool clientSurrounding =
+        ic_->capabilityFlags().test(CapabilityFlag::SurroundingText);
+    const bool emulate = emulateSurroundingText();
     if (command == Minput_get_surrounding_text &&
-        ic_->capabilityFlags().test(CapabilityFlag::SurroundingText) &&
-        ic_->surroundingText().isValid()) {
-        const auto &text = ic_->surroundingText().text();
-        size_t nchars = utf8::length(text);
-        size_t nbytes = text.size();
-        MText *mt = mconv_decode_buffer(
-            Mcoding_utf_8, reinterpret_cast<const unsigned char *>(text.data()),
-            nbytes);
-        MText *surround = nullptr;
-        if (!mt) {
-            return;
-        }
-
+        ((clientSurrounding && ic_->surroundingText().isValid()) ||
+         emulate)) {
         long len = (long)mplist_value(context->plist);
-        long pos;
-        auto cursor = ic_->surroundingText().cursor();
-        if (len < 0) {
-            pos = cursor + len;
-            if (pos < 0) {
-                pos = 0;
+        if (len != 0) {
+            MText *surround =
+                emulate ? surroundingText(committed_, committedLength_, len)
+                        : surroundingText(ic_->surroundingText().text(),
+                                          ic_->surroundingText().cursor(),
+                                          len);
+            if (surround) {
+                mplist_set(context->plist, Mtext, surround);
+                m17n_object_unref(surround);
             }
-            surround = mtext_duplicate(mt, pos, cursor);
-        } else if (len > 0) {
-            pos = cursor + len;
-            if (pos > static_cast<long>(nchars)) {
-                pos = nchars;
-            }
-            surround = mtext_duplicate(mt, cursor, pos);
         } else {
-            surround = mtext();
-        }
-        m17n_object_unref(mt);
-        if (surround) {
-            mplist_set(context->plist, Mtext, surround);
-            m17n_object_unref(surround);
+            if (!emptyText_ || mtext_len(emptyText_.get()) != 0) {
+                emptyText_.reset(mtext());
+            }
+            // The list takes its own reference.
+            mplist_set(context->plist, Mtext, emptyText_.get());
         }
     } else if (command == Minput_delete_surrounding_text &&
-               ic_->capabilityFlags().test(CapabilityFlag::SurroundingText)) {
+               (clientSurrounding || emulate)) {
         int len = reinterpret_cast<long>(mplist_value(context->plist));
-        if (len < 0) {
+        if (emulate) {
+            deleteCommitted(len);
+        } else if (len < 0) {
             ic_->deleteSurroundingText(len, -len);
         } else if (len > 0) {
             ic_->deleteSurroundingText(0, len);
         }
+        // The client text changed, don't answer from the old copy.
+        surroundingValid_ = false;
     }
 }
 
-void M17NState::keyEvent(const InputMethodEntry &entry, KeyEvent &keyEvent) {
-    const auto *data = static_cast<const M17NData *>(entry.userData());
-    if (!mim_ || data->language() != mim_->language ||
-        data->name() != mim_->name) {
-        mic_.reset();
-        mim_.reset(minput_open_im(data->language(), data->name(), nullptr));
+bool M17NState::emulateSurroundingText() const {
+    // A terminal hands forwarded keys to whatever runs in it, which need not
+    // be editing the committed text, so the text could not be deleted.
+    return !ic_->capabilityFlags().testAny(CapabilityFlags{
+               CapabilityFlag::SurroundingText, CapabilityFlag::Terminal}) &&
+           *engine_->config().emulateSurroundingText;
+}
 
-        mplist_put(mim_->driver.callback_list, Minput_get_surrounding_text,
-                   reinterpret_cast<void *>(&M17NState::callback));
-        mplist_put(mim_->driver.callback_list, Minput_delete_surrounding_text,
-                   reinterpret_cast<void *>(&M17NState::callback));
+void M17NState::appendCommitted(std::string_view text) {
+    // Keep the last MaxCommittedLength characters, enough for the context
+    // that input methods look at.
+    constexpr long MaxCommittedLength = 64;
+    committed_.append(text);
+    committedLength_ += static_cast<long>(utf8::length(text));
+    if (committedLength_ > MaxCommittedLength) {
+        const auto drop = utf8::ncharByteLength(
+            committed_.begin(), committedLength_ - MaxCommittedLength);
+        committed_.erase(0, drop);
+        committedLength_ = MaxCommittedLength;
+    }
+}
+
+void M17NState::deleteCommitted(int len) {
+    // Without surrounding text support, the client only knows keys. It is
+    // told to delete in its own text, the local copy follows.
+    const Key key(len < 0 ? FcitxKey_BackSpace : FcitxKey_Delete);
+    for (int i = 0; i < std::abs(len); i++) {
+        ic_->forwardKey(key, false);
+        ic_->forwardKey(key, true);
+    }
+    if (len < 0) {
+        trimCommitted(-len);
+    }
+}
+
+void M17NState::trimCommitted(long count) {
+    const long keep = std::max(0L, committedLength_ - count);
+    committed_.resize(utf8::ncharByteLength(committed_.begin(), keep));
+    committedLength_ = keep;
+}
+
+void M17NState::clearCommitted() {
+    committed_.clear();
+    committedLength_ = 0;
+}
+
+MText *M17NState::surroundingText(const std::string &text, long cursor,
+                                  long len) {
+    // Decode a little more than asked for, m17n tends to ask for the
+    // characters around the cursor several times during one key.
+    constexpr long minWindow = 16;
+    const long from = std::max(0L, cursor + std::min(len, 0L));
+    const long to = cursor + std::max(len, 0L);
+
+    if (!surroundingValid_ || from < surroundingBegin_ ||
+        (to > surroundingEnd_ && !surroundingAtEnd_)) {
+        // Only the part of the text around the cursor is decoded, the rest is
+        // just skipped over.
+        const size_t cursorByte = utf8::ncharByteLength(text.begin(), cursor);
+        size_t beginByte = cursorByte;
+        long before = std::max(cursor - from, minWindow);
+        long begin = cursor;
+        for (; before > 0 && beginByte > 0; before--, begin--) {
+            do {
+                beginByte--;
+            } while (beginByte > 0 && (text[beginByte] & 0xc0) == 0x80);
+        }
+        size_t endByte = cursorByte;
+        long after = std::max(to - cursor, minWindow);
+        long end = cursor;
+        for (; after > 0 && endByte < text.size(); after--, end++) {
+            do {
+                endByte++;
+            } while (endByte < text.size() && (text[endByte] & 0xc0) == 0x80);
+        }
+
+        // Decode into the text and with the converter of the previous key.
+        const auto *data =
+            reinterpret_cast<const unsigned char *>(text.data()) + beginByte;
+        const int size = static_cast<int>(endByte - beginByte);
+        MText *mt = ClearText(surrounding_);
+        if (size > 0) {
+            if (decoder_) {
+                mconv_reset_converter(decoder_.get());
+                mconv_rebind_buffer(decoder_.get(), data, size);
+            } else {
+                decoder_.reset(
+                    mconv_buffer_converter(Mcoding_utf_8, data, size));
+            }
+            if (!decoder_ || !mconv_decode(decoder_.get(), mt)) {
+                return nullptr;
+            }
+        }
+        surroundingValid_ = true;
+        surroundingBegin_ = begin;
+        surroundingEnd_ = end;
+        surroundingAtEnd_ = endByte == text.size();
+    }
+
+    return mtext_duplicate(surrounding_.get(), from - surroundingBegin_,
+                           std::min(to, surroundingEnd_) - surroundingBegin_);
+}
+
+M17NState::~M17NState() { releaseContext(); }
+
+void M17NState::releaseContext() {
+    engine_->removeState(this);
+    if (mic_) {
+        engine_->releaseContext(mim_, std::move(mic_));
+    }
+}
+
+void M17NState::evict() {
+    releaseContext();
+    mim_.reset();
+    surroundingValid_ = false;
+    surrounding_.reset();
+    produced_.reset();
+    emptyText_.reset();
+    decoder_.reset();
+    uiValid_ = false;
+}
+
+void M17NState::prepare(MSymbol language, MSymbol name) {
+    if (!mim_ || language != mim_->language || name != mim_->name) {
+        releaseContext();
+        mim_ = engine_->inputMethod(language, name);
+        stats_ = &engine_->inputMethodStats(language, name);
+        usage_ = &engine_->usage(language, name);
+        status_.clear();
     }
 
     if (!mic_ && mim_) {
-        mic_.reset(minput_create_ic(mim_.get(), this));
+        mic_ = engine_->acquireContext(mim_, this);
+        // A new context starts with the initial status of the input method.
+        updateStatus();
+    }
+    if (mic_) {
+        engine_->touchState(this);
+    }
+}
+
+void M17NState::keyEvent(const InputMethodEntry &entry, KeyEvent &keyEvent) {
+    const auto *data = static_cast<const M17NData *>(entry.userData());
+    prepare(data->language(), data->name());
+    if (usage_) {
+        usage_->keys++;
+        usage_->lastUsed = std::time(nullptr);
     }
 
-    if (this->keyEvent(keyEvent.rawKey())) {
+    const auto &key = keyEvent.rawKey();
+    if (this->keyEvent(key)) {
         keyEvent.filterAndAccept();
+    } else if (emulateSurroundingText() && !key.isModifier()) {
+        // The key goes to the client, keep the copy of its text in step.
+        const uint32_t chr = Key::keySymToUnicode(key.sym());
+        if (key.check(FcitxKey_BackSpace)) {
+            trimCommitted(1);
+        } else if (chr >= 0x20 && chr != 0x7f &&
+                   !key.states().testAny(
+                       KeyStates{KeyState::Ctrl, KeyState::Alt,
+                                 KeyState::Super, KeyState::Hyper})) {
+            appendCommitted(utf8::UCS4ToUTF8(chr));
+        } else {
+            // Anything else may move the cursor.
+            clearCommitted();
+        }
     }
 }
 
@@ -492,12 +1456,17 @@ bool M17NState::keyEvent(const Key &key) {
     if (!mic_) {
         return false;
     }
-    MSymbol msym = KeySymToSymbol(key);
+    MSymbol msym;
+    {
+        SpanTimer timer(&stats_->keySymbol);
+        msym = engine_->keySymbol(key);
+    }
 
     if (msym == Mnil) {
         FCITX_M17N_DEBUG() << key << " not my dish";
         return false;
     }
+    FCITX_M17N_DEBUG() << "M17n key str: " << msymbol_name(msym) << " " << key;
     return handleKey(msym);
 }
 
@@ -505,59 +1474,196 @@ bool M17NState::handleKey(MSymbol key) {
     if (!mic_) {
         return false;
     }
+    SpanTimer timer(&stats_->handleKey);
+    // The surrounding text may have changed since the last key.
+    surroundingValid_ = false;
     int thru = 0;
-    if (!minput_filter(mic_.get(), key, nullptr)) {
-        MText *produced = mtext();
+    bool committed = false;
+    bool filtered;
+    {
+        SpanTimer filterTimer(&stats_->filter);
+        filtered = minput_filter(mic_.get(), key, nullptr);
+    }
+    // The next minput_filter() clears the flags, which may come before the
+    // UI is updated with coalesced or deferred updates.
+    preeditDirty_ = preeditDirty_ || mic_->preedit_changed;
+    candidatesDirty_ = candidatesDirty_ || mic_->candidates_changed;
+    statusDirty_ = statusDirty_ || mic_->status_changed;
+    if (!filtered) {
+        MText *produced = ClearText(produced_);
         // If input symbol was let through by m17n, let Fcitx handle it.
         // m17n may still produce some text to commit, though.
-        thru = minput_lookup(mic_.get(), key, NULL, produced);
+        {
+            SpanTimer lookupTimer(&stats_->lookup);
+            thru = minput_lookup(mic_.get(), key, NULL, produced);
+        }
         if (mtext_len(produced) > 0) {
-            auto buf = MTextToUTF8(produced);
-            ic_->commitString(buf);
+            {
+                SpanTimer convertTimer(&stats_->textConversion);
+                engine_->converter().convert(produced, buffer_);
+            }
+            ic_->commitString(buffer_);
+            if (emulateSurroundingText()) {
+                appendCommitted(buffer_);
+            }
+            committed = true;
         }
-        m17n_object_unref(produced);
     }
 
-    updateUI();
+    if (committed) {
+        // The client must not show the old preedit next to the commit.
+        updateUI();
+    } else {
+        scheduleUpdateUI();
+    }
 
     return !thru;
 }
 
+void M17NState::scheduleUpdateUI() {
+    if (deferUpdate_ || !*engine_->config().coalesceUIUpdates) {
+        updateUI();
+        return;
+    }
+    if (updateScheduled_) {
+        return;
+    }
+    updateScheduled_ = true;
+    engine_->instance()->eventDispatcher().schedule(
+        [engine = engine_, ref = ic_->watch()]() {
+            auto *ic = ref.get();
+            if (!ic) {
+                return;
+            }
+            auto *state = ic->propertyFor(engine->factory());
+            if (state->updateScheduled_) {
+                state->updateUI();
+            }
+        });
+}
+
 void M17NState::updateUI() {
-    ic_->inputPanel().reset();
+    if (deferUpdate_) {
+        pendingUpdate_ = true;
+        return;
+    }
+    updateScheduled_ = false;
+    SpanTimer timer(stats_ ? &stats_->updateUI : nullptr);
+
+    auto &panel = ic_->inputPanel();
+    const bool clientPreedit =
+        ic_->capabilityFlags().test(CapabilityFlag::Preedit);
+    // Something else may have reset the input panel since the last update.
+    if (uiValid_ &&
+        (preeditShown_ ==
+             (clientPreedit ? panel.clientPreedit() : panel.preedit())
+                 .empty() ||
+         panel.candidateList().get() != candidateList_)) {
+        uiValid_ = false;
+    }
+
+    bool preeditChanged = !uiValid_;
+    bool candidatesChanged = !uiValid_;
+    bool statusChanged = !uiValid_;
     if (mic_) {
-        if (mic_->preedit) {
-            auto preedit = MTextToUTF8(mic_->preedit);
-            if (!preedit.empty()) {
-                SetPreedit(ic_, preedit, mic_->cursor_pos);
-            }
-            FCITX_M17N_DEBUG() << "IM preedit changed to " << preedit;
+        // m17n clears these flags at the beginning of every minput_filter(),
+        // handleKey() keeps them since the last update.
+        preeditChanged = preeditChanged || preeditDirty_ ||
+                         mic_->preedit_changed ||
+                         mic_->cursor_pos != preeditCursor_;
+        candidatesChanged = candidatesChanged || candidatesDirty_ ||
+                            mic_->candidates_changed ||
+                            mic_->candidate_list != candidates_ ||
+                            mic_->candidate_index != candidateIndex_ ||
+                            (mic_->candidate_show != 0) != candidateShow_;
+        statusChanged = statusChanged || statusDirty_ || mic_->status_changed;
+    }
+    preeditDirty_ = false;
+    candidatesDirty_ = false;
+    statusDirty_ = false;
+
+    // The candidate segment is part of the preedit.
+    if (preeditChanged || candidatesChanged) {
+        auto &preedit = nextPreedit_;
+        int cursor = -1;
+        if (mic_ && mic_->preedit) {
+            SpanTimer convertTimer(&stats_->textConversion);
+            cursor = mic_->cursor_pos;
+            engine_->converter().convertPreedit(
+                mic_->preedit, cursor,
+                mic_->candidate_list ? mic_->candidate_from : -1,
+                mic_->candidate_to, preedit);
+            FCITX_M17N_DEBUG() << "IM preedit changed to " << preedit.text;
+        } else {
+            engine_->converter().convertPreedit(nullptr, -1, -1, -1, preedit);
         }
-
-        if (mic_->status) {
-            auto mstatus = MTextToUTF8(mic_->status);
-            // toShow = toShow || (strlen(mstatus) != 0);
-            if (!mstatus.empty()) {
-                FCITX_M17N_DEBUG() << "IM status changed to " << mstatus;
+        if (uiValid_ && preedit == preedit_ && cursor == preeditCursor_) {
+            preeditChanged = false;
+        } else {
+            preeditChanged = true;
+            panel.setClientPreedit(Text());
+            panel.setPreedit(Text());
+            if (!preedit.text.empty()) {
+                SetPreedit(ic_, preedit);
             }
+            preeditCursor_ = cursor;
+            preeditShown_ = !preedit.text.empty();
+            // Both keep their capacity for the next update.
+            std::swap(preedit_, nextPreedit_);
         }
-        if (mic_->candidate_list && mic_->candidate_show) {
+    }
+
+    if (statusChanged) {
+        updateStatus();
+    }
+
+    if (candidatesChanged) {
+        panel.setCandidateList(nullptr);
+        candidateList_ = nullptr;
+        candidates_ = mic_ ? mic_->candidate_list : nullptr;
+        candidateIndex_ = mic_ ? mic_->candidate_index : -1;
+        candidateShow_ = mic_ && mic_->candidate_show;
+        if (candidates_ && candidateShow_) {
             auto candList = std::make_unique<M17NCandidateList>(engine_, ic_);
             if (candList->size()) {
-                candList->setGlobalCursorIndex(mic_->candidate_index);
-                ic_->inputPanel().setCandidateList(std::move(candList));
+                candidateList_ = candList.get();
+                panel.setCandidateList(std::move(candList));
             }
         }
     }
-    ic_->updatePreedit();
-    ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
+    uiValid_ = true;
+
+    if (preeditChanged) {
+        ic_->updatePreedit();
+    }
+    if ((preeditChanged && !clientPreedit) || candidatesChanged) {
+        ic_->updateUserInterface(UserInterfaceComponent::InputPanel);
+    }
+}
+
+void M17NState::updateStatus() {
+    std::string_view status;
+    if (mic_ && mic_->status) {
+        status = engine_->converter().convert(mic_->status);
+    }
+    if (status == status_) {
+        return;
+    }
+    status_ = status;
+    FCITX_M17N_DEBUG() << "IM status changed to " << status_;
+    ic_->updateUserInterface(UserInterfaceComponent::StatusArea);
 }
 
 void M17NState::reset() {
     if (!mic_) {
         return;
     }
-    mic_.reset();
+    // Same as a new context, without the cost of creating one.
+    minput_reset_ic(mic_.get());
+    surroundingValid_ = false;
+    // The cursor may be anywhere after a reset or a focus change.
+    clearCommitted();
+    uiValid_ = false;
     updateUI();
 }
 
@@ -571,9 +1677,12 @@ void M17NState::commitPreedit() {
     if (!mic_->preedit) {
         return;
     }
-    auto preedit = MTextToUTF8(mic_->preedit);
-    if (!preedit.empty()) {
-        ic_->commitString(preedit);
+    engine_->converter().convert(mic_->preedit, buffer_);
+    if (!buffer_.empty()) {
+        ic_->commitString(buffer_);
+        if (emulateSurroundingText()) {
+            appendCommitted(buffer_);
+        }
     }
 }
 
@@ -582,6 +1691,51 @@ void M17NState::select(int index) {
         return;
     }
 
+    // Every key sent below would otherwise rebuild the UI, only the final
+    // state is interesting.
+    deferUpdate_ = true;
+    pendingUpdate_ = false;
+    selectCandidate(index);
+    deferUpdate_ = false;
+    if (pendingUpdate_) {
+        pendingUpdate_ = false;
+        updateUI();
+    }
+}
+
+void M17NState::selectCandidate(int index) {
+    int start = 0;
+    const int targetGroup = CandidateGroup(mic_->candidate_list, index, &start);
+    if (targetGroup < 0) {
+        return;
+    }
+
+    // Up/Down skips a whole group at once, use it to get close to the target.
+    // Elsewhere they may commit or change the preedit, so only where the
+    // input method binds them to group moves. Still stop as soon as the group
+    // does not move towards the target.
+    const bool groupKeys = engine_->bindsGroupKeys(mim_->language, mim_->name);
+    while (groupKeys && mic_ && mic_->candidate_list && mic_->candidate_show) {
+        const int group = CandidateGroup(mic_->candidate_list,
+                                         mic_->candidate_index, nullptr);
+        if (group < 0 || group == targetGroup) {
+            break;
+        }
+        keyEvent(Key(group < targetGroup ? FcitxKey_Down : FcitxKey_Up));
+        if (!mic_) {
+            return;
+        }
+        const int newGroup = CandidateGroup(mic_->candidate_list,
+                                            mic_->candidate_index, nullptr);
+        if (newGroup < 0 || (group < targetGroup && newGroup <= group) ||
+            (group > targetGroup && newGroup >= group)) {
+            break;
+        }
+    }
+
+    if (!mic_) {
+        return;
+    }
     int lastIdx = mic_->candidate_index;
     do {
         if (index == mic_->candidate_index) {
@@ -593,37 +1747,19 @@ void M17NState::select(int index) {
             keyEvent(Key(FcitxKey_Left));
         }
         /* though useless, but take care if there is a bug cause freeze */
-        if (lastIdx == mic_->candidate_index) {
+        if (!mic_ || lastIdx == mic_->candidate_index) {
             break;
         }
         lastIdx = mic_->candidate_index;
     } while (mic_->candidate_list && mic_->candidate_show);
 
-    if (!mic_->candidate_list || !mic_->candidate_show ||
-        index != mic_->candidate_index) {
+    if (!mic_ || !mic_->candidate_list || !mic_->candidate_show ||
+        index != mic_->candidate_index ||
+        CandidateGroup(mic_->candidate_list, index, &start) < 0) {
         return;
     }
 
-    MPlist *head = mic_->candidate_list;
-
-    int i = 0;
-    while (1) {
-        int len;
-        if (mplist_key(head) == Mtext) {
-            len = mtext_len((MText *)mplist_value(head));
-        } else {
-            len = mplist_length((MPlist *)mplist_value(head));
-        }
-
-        if (i + len > index) {
-            break;
-        }
-
-        i += len;
-        head = mplist_next(head);
-    }
-
-    int delta = index - i;
+    int delta = index - start;
 
     KeySym sym = FcitxKey_1;
     if ((delta + 1) % 10 == 0) {
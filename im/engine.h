@@ -7,30 +7,72 @@
 #ifndef _IM_ENGINE_H_
 #define _IM_ENGINE_H_
 
+#include "directorywatcher.h"
+#include "imlistcache.h"
+#include "keysymbol.h"
+#include "m17n_public.h"
+#include "mtextconverter.h"
 #include "overrideparser.h"
+#include "spantimer.h"
+#include "usage.h"
 #include <fcitx-config/configuration.h>
 #include <fcitx-config/iniparser.h>
 #include <fcitx-config/option.h>
 #include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/event.h>
 #include <fcitx-utils/i18n.h>
 #include <fcitx-utils/key.h>
 #include <fcitx/addonfactory.h>
 #include <fcitx/addoninstance.h>
 #include <fcitx/addonmanager.h>
+#include <fcitx/candidatelist.h>
 #include <fcitx/event.h>
 #include <fcitx/inputcontextproperty.h>
 #include <fcitx/inputmethodengine.h>
 #include <fcitx/inputmethodentry.h>
 #include <m17n-core.h>
 #include <m17n.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 namespace fcitx {
 
-FCITX_CONFIGURATION(M17NConfig, Option<bool> enableDeprecated{
-                                    this, "EnableDeprecated",
-                                    _("Enable Deprecated"), false};);
+FCITX_CONFIGURATION(
+    M17NConfig,
+    Option<bool> enableDeprecated{this, "EnableDeprecated",
+                                  _("Enable Deprecated"), false};
+    Option<int, IntConstrain> maxContexts{
+        this, "MaxContexts", _("Maximum number of active m17n contexts"), 64,
+        IntConstrain(1, 100000)};
+    Option<int, IntConstrain> idleTimeout{
+        this, "IdleTimeout",
+        _("Free m17n contexts unused for (minutes, 0 to disable)"), 60,
+        IntConstrain(0, 24 * 60)};
+    Option<bool> coalesceUIUpdates{
+        this, "CoalesceUIUpdates",
+        _("Update the input panel once for a burst of keys"), false};
+    Option<bool> emulateSurroundingText{
+        this, "EmulateSurroundingText",
+        _("Remember committed text for clients without surrounding text"),
+        true};
+    Option<int, IntConstrain> prewarmCount{
+        this, "PrewarmCount",
+        _("Number of most used input methods to load at startup"), 3,
+        IntConstrain(0, 32)};
+    Option<int, IntConstrain> prewarmBudget{
+        this, "PrewarmBudget",
+        _("Memory for input methods loaded at startup (KiB, 0 for no limit)"),
+        32768, IntConstrain(0, 1024 * 1024)};);
 
 class M17NData : public InputMethodEntryUserData {
 public:
@@ -45,42 +87,173 @@ private:
     MSymbol name_;
 };
 
+using M17NInputMethodKey = std::pair<MSymbol, MSymbol>;
+
+struct M17NInputMethodKeyHash {
+    size_t operator()(const M17NInputMethodKey &key) const {
+        std::hash<MSymbol> hash;
+        return hash(key.first) ^ (hash(key.second) << 1);
+    }
+};
+
+// m17n variables that are needed on the key path, resolved once per input
+// method by M17NEngine.
+struct M17NVariables {
+    std::optional<int> pageSize;
+    std::optional<MSymbol> candidatesCharset;
+    std::optional<bool> bindsGroupKeys;
+};
+
+using M17NInputContextPtr =
+    std::unique_ptr<MInputContext, decltype(&minput_destroy_ic)>;
+using MTextPtr = std::unique_ptr<MText, decltype(&m17n_object_unref)>;
+
+// Idle m17n input contexts of one input method, kept for reuse. Holds a
+// reference on the input method, which must outlive its contexts.
+struct M17NContextPool {
+    struct Entry {
+        M17NInputContextPtr mic;
+        // CLOCK_MONOTONIC time when the context was put into the pool.
+        uint64_t idleSince;
+    };
+    std::shared_ptr<MInputMethod> mim;
+    std::vector<Entry> contexts;
+};
+
 class M17NEngine;
 
 class M17NState : public InputContextProperty {
 public:
     M17NState(M17NEngine *engine, InputContext *ic)
-        : engine_(engine), ic_(ic), mim_(nullptr, &minput_close_im),
-          mic_(nullptr, &minput_destroy_ic) {}
+        : engine_(engine), ic_(ic), mic_(nullptr, &minput_destroy_ic) {}
+    ~M17NState();
 
+    // Open the input method and create the input context if needed.
+    void prepare(MSymbol language, MSymbol name);
     void keyEvent(const InputMethodEntry &entry, KeyEvent &keyEvent);
-    void command(MInputContext *context, MSymbol command) const;
+    void command(MInputContext *context, MSymbol command);
     void updateUI();
+    // Same as updateUI(), but with CoalesceUIUpdates only marks the UI dirty
+    // and updates it once the event loop is idle.
+    void scheduleUpdateUI();
     void select(int index);
     void reset();
     void commitPreedit();
+    // Feed a key to m17n. Also used for the keys that candidate selection
+    // and paging make up, which never reach the client.
     bool keyEvent(const Key &key);
 
     static void callback(MInputContext *context, MSymbol command);
 
     MInputMethod *mim() const { return mim_.get(); }
     MInputContext *mic() const { return mic_.get(); }
+    // The status m17n last reported for the input method, e.g. the current
+    // mode. Shown as the sub mode of the input method.
+    const std::string &status() const { return status_; }
+
+    // Whether the user can see anything of the m17n state, i.e. whether
+    // evict() would be noticed.
+    bool busy() const { return preeditShown_ || candidateShow_; }
+    // Free the m17n context. The next key prepares a new one.
+    void evict();
 
 private:
+    friend class M17NEngine;
+
     bool handleKey(MSymbol key);
+    // Pick up mic_->status and refresh the status area if it differs from
+    // status_.
+    void updateStatus();
+    // Return len characters of text before (len < 0) or after (len > 0)
+    // cursor as a new MText.
+    MText *surroundingText(const std::string &text, long cursor, long len);
+    // Whether m17n gets the surrounding text from committed_ instead of the
+    // client.
+    bool emulateSurroundingText() const;
+    void appendCommitted(std::string_view text);
+    // Remove count characters from the end of committed_.
+    void trimCommitted(long count);
+    void clearCommitted();
+    // Delete len characters before (len < 0) or after (len > 0) the cursor
+    // by forwarding BackSpace or Delete to the client.
+    void deleteCommitted(int len);
+    void selectCandidate(int index);
+    // Give mic_ back to the engine's pool.
+    void releaseContext();
 
     M17NEngine *engine_;
     InputContext *ic_;
-    std::unique_ptr<MInputMethod, decltype(&minput_close_im)> mim_;
-    std::unique_ptr<MInputContext, decltype(&minput_destroy_ic)> mic_;
+    // Counters of the input method in mim_, owned by M17NEngine.
+    M17NInputMethodStats *stats_ = nullptr;
+    M17NUsage *usage_ = nullptr;
+    // Shared with every other input context using the same input method, owned
+    // by M17NEngine. Declared before mic_ so the context is destroyed first.
+    std::shared_ptr<MInputMethod> mim_;
+    M17NInputContextPtr mic_;
+    // Position in M17NEngine's list of states holding a context, most
+    // recently used first, and the CLOCK_MONOTONIC time of the last use.
+    std::optional<std::list<M17NState *>::iterator> lruEntry_;
+    uint64_t lastUsed_ = 0;
+    // Reused for commit and preedit text to avoid a string per key.
+    std::string buffer_;
+
+    // Scratch objects of the key path, created on first use and emptied
+    // instead of freed between key events. produced_ receives the text m17n
+    // commits, emptyText_ answers requests for no surrounding text and is
+    // never modified.
+    MTextPtr produced_{nullptr, &m17n_object_unref};
+    MTextPtr emptyText_{nullptr, &m17n_object_unref};
+    std::unique_ptr<MConverter, decltype(&mconv_free_converter)> decoder_{
+        nullptr, &mconv_free_converter};
+
+    // The text committed since the last reset, as far as the client can be
+    // followed without SurroundingText. The cursor is at the end.
+    std::string committed_;
+    long committedLength_ = 0;
+
+    // Decoded window [surroundingBegin_, surroundingEnd_) of the surrounding
+    // text, in characters, if surroundingValid_. Valid until the next key
+    // event.
+    MTextPtr surrounding_{nullptr, &m17n_object_unref};
+    bool surroundingValid_ = false;
+    long surroundingBegin_ = 0;
+    long surroundingEnd_ = 0;
+    bool surroundingAtEnd_ = false;
+
+    // What updateUI() last pushed to the input panel, so that it only needs
+    // to rebuild the parts m17n changed. uiValid_ = false forces a full
+    // update.
+    bool uiValid_ = false;
+    M17NPreedit preedit_;
+    // Where the next preedit is converted to before comparing it with
+    // preedit_.
+    M17NPreedit nextPreedit_;
+    int preeditCursor_ = -1;
+    bool preeditShown_ = false;
+    MPlist *candidates_ = nullptr;
+    int candidateIndex_ = -1;
+    bool candidateShow_ = false;
+    const CandidateList *candidateList_ = nullptr;
+    std::string status_;
+    // Set while select() sends keys to m17n, updateUI() only records that an
+    // update is needed.
+    bool deferUpdate_ = false;
+    bool pendingUpdate_ = false;
+    // An update is scheduled on the event dispatcher, any updateUI() before
+    // it runs makes it a no-op.
+    bool updateScheduled_ = false;
+    // m17n's change flags of every key since the last updateUI().
+    bool preeditDirty_ = false;
+    bool candidatesDirty_ = false;
+    bool statusDirty_ = false;
 };
 
-class M17NEngine : public InputMethodEngine {
+class M17NEngine : public InputMethodEngineV2 {
 public:
     M17NEngine(Instance *instance);
 
-    void activate(const fcitx::InputMethodEntry & /*entry*/,
-                  fcitx::InputContextEvent & /*event*/) override;
+    void activate(const fcitx::InputMethodEntry &entry,
+                  fcitx::InputContextEvent &event) override;
     void deactivate(const fcitx::InputMethodEntry &entry,
                     fcitx::InputContextEvent &event) override;
     void keyEvent(const fcitx::InputMethodEntry &entry,
@@ -89,20 +262,133 @@ public:
     void reset(const fcitx::InputMethodEntry & /*entry*/,
                fcitx::InputContextEvent & /*event*/) override;
     auto factory() { return &factory_; }
+    Instance *instance() { return instance_; }
+    const M17NConfig &config() const { return config_; }
 
     const Configuration *getConfig() const override { return &config_; }
     void setConfig(const RawConfig &config) override {
+        const bool enableDeprecated = *config_.enableDeprecated;
         config_.load(config, true);
         safeSaveAsIni(config_, "conf/m17n.conf");
+        configChanged(enableDeprecated);
     }
 
     std::vector<InputMethodEntry> listInputMethods() override;
+    void save() override;
+    std::string subMode(const InputMethodEntry &entry,
+                        InputContext &inputContext) override;
+    std::string subModeLabelImpl(const InputMethodEntry &entry,
+                                 InputContext &inputContext) override;
+
+    // Return the shared MInputMethod for (language, name), opening it on first
+    // use. Returns nullptr if m17n fails to open it.
+    std::shared_ptr<MInputMethod> inputMethod(MSymbol language, MSymbol name);
+
+    // Cached values of the candidates-group-size and candidates-charset
+    // variables.
+    int pageSize(MSymbol language, MSymbol name);
+    MSymbol candidatesCharset(MSymbol language, MSymbol name);
+    // Cached, whether Up and Down move between candidate groups.
+    bool bindsGroupKeys(MSymbol language, MSymbol name);
+
+    MTextConverter &converter() { return converter_; }
+    MSymbol keySymbol(const Key &key) { return keySymbols_.lookup(key); }
+
+    // Take an idle context of mim from the pool, or create a new one. The
+    // arg of the context is set to state.
+    M17NInputContextPtr acquireContext(const std::shared_ptr<MInputMethod> &mim,
+                                       M17NState *state);
+    // Reset mic and keep it for a later acquireContext() on the same input
+    // method.
+    void releaseContext(const std::shared_ptr<MInputMethod> &mim,
+                        M17NInputContextPtr mic);
+    // Record that state holds a context and was just used, and keep the
+    // number of such states under MaxContexts.
+    void touchState(M17NState *state);
+    void removeState(M17NState *state);
+
+    // Usage record of (language, name), created on first use. The reference
+    // stays valid for the lifetime of the engine.
+    M17NUsage &usage(MSymbol language, MSymbol name);
+
+    // Counters of (language, name), created on first use. The reference stays
+    // valid for the lifetime of the engine.
+    M17NInputMethodStats &inputMethodStats(MSymbol language, MSymbol name);
+    std::vector<M17NInputMethodStats> statistics() const;
+    void resetStatistics();
+
+    std::optional<std::string> transliterateKeys(const std::string &uniqueName,
+                                                 const std::vector<Key> &keys);
+    std::optional<std::string> transliterate(const std::string &uniqueName,
+                                             const std::string &text);
 
 private:
+    // Walk m17n-db for all usable input methods, including deprecated ones.
+    std::vector<M17NInputMethodInfo> enumerateInputMethods();
+    M17NVariables &variables(MSymbol language, MSymbol name);
+    // Called with the files that changed in the m17n database directories or
+    // the directory of the override file.
+    void databaseChanged(const std::unordered_set<std::string> &paths);
+    // Apply a new config_, enableDeprecated is the value before the change.
+    void configChanged(bool enableDeprecated);
+    InputMethodEntry makeEntry(const M17NInputMethodInfo &info) const;
+    // The key of the listed, enabled input method with uniqueName.
+    std::optional<M17NInputMethodKey>
+    listedInputMethod(std::string_view uniqueName) const;
+    // Drop everything cached for the input method, so that it is opened
+    // again from the database on next use.
+    void forgetInputMethod(const M17NInputMethodKey &key);
+    // Status of the state of inputContext, if it uses the input method of
+    // entry.
+    std::string status(const InputMethodEntry &entry,
+                       InputContext &inputContext);
+    // Open the next of the most used input methods, returns whether there is
+    // more to do.
+    bool prewarmNext();
+    // Free pooled contexts that have been idle for too long.
+    void trimContextPools();
+    // Evict the least recently used states over MaxContexts and the ones
+    // idle for longer than IdleTimeout, except keep and busy states.
+    void evictStates(M17NState *keep);
+
     Instance *instance_;
     M17NConfig config_;
-    std::vector<OverrideItem> list_;
+    std::string overridePath_;
+    OverrideTable list_;
+    // What listInputMethods() last returned, including deprecated ones.
+    std::vector<M17NInputMethodInfo> infos_;
+    // Set while the engine asks the input method manager to refresh, so
+    // that listInputMethods() answers from infos_.
+    bool refreshing_ = false;
+    MTextConverter converter_;
+    KeySymbolCache keySymbols_;
+    std::unordered_map<M17NInputMethodKey, std::shared_ptr<MInputMethod>,
+                       M17NInputMethodKeyHash>
+        inputMethods_;
+    std::unordered_map<M17NInputMethodKey, M17NVariables,
+                       M17NInputMethodKeyHash>
+        variables_;
+    std::unordered_map<M17NInputMethodKey, M17NInputMethodStats,
+                       M17NInputMethodKeyHash>
+        stats_;
+    std::unordered_map<M17NInputMethodKey, M17NContextPool,
+                       M17NInputMethodKeyHash>
+        contextPools_;
+    std::unique_ptr<EventSourceTime> poolTimer_;
+    std::list<M17NState *> liveStates_;
+    std::unique_ptr<EventSourceTime> idleTimer_;
+    std::unique_ptr<DirectoryWatcher> watcher_;
+    std::unordered_map<M17NInputMethodKey, M17NUsage, M17NInputMethodKeyHash>
+        usage_;
+    std::vector<M17NInputMethodKey> prewarmQueue_;
+    size_t prewarmBytes_ = 0;
+    std::unique_ptr<EventSource> prewarmEvent_;
     FactoryFor<M17NState> factory_;
+
+    FCITX_ADDON_EXPORT_FUNCTION(M17NEngine, statistics);
+    FCITX_ADDON_EXPORT_FUNCTION(M17NEngine, resetStatistics);
+    FCITX_ADDON_EXPORT_FUNCTION(M17NEngine, transliterateKeys);
+    FCITX_ADDON_EXPORT_FUNCTION(M17NEngine, transliterate);
 };
 
 class M17NEngineFactory : public AddonFactory {
@@ -0,0 +1,142 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "imlistcache.h"
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fcitx-utils/fdstreambuf.h>
+#include <fcitx-utils/standardpaths.h>
+#include <fcitx-utils/stringutils.h>
+#include <filesystem>
+#include <istream>
+#include <m17n-core.h>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace fcitx {
+
+namespace {
+
+constexpr char cacheFile[] = "m17n/inputmethods.cache";
+constexpr std::string_view cacheMagic = "fcitx5-m17n-inputmethods 2";
+
+void AppendPathStamp(std::string &stamp, const std::string &path) {
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    long long value = 0;
+    if (!ec) {
+        value = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    mtime.time_since_epoch())
+                    .count();
+    }
+    stamp.append(path);
+    stamp.push_back('=');
+    stamp.append(std::to_string(value));
+    stamp.push_back(';');
+}
+
+bool IsValidField(const std::string &field) {
+    return field.find_first_of("\t\n") == std::string::npos;
+}
+
+} // namespace
+
+std::vector<std::string> M17NDatabaseDirectories() {
+    std::vector<std::string> directories{M17N_DB_DIR};
+    if (mdatabase_dir) {
+        directories.emplace_back(mdatabase_dir);
+    }
+    if (const char *dir = getenv("M17NDIR")) {
+        directories.emplace_back(dir);
+    } else if (const char *home = getenv("HOME")) {
+        directories.push_back(stringutils::joinPath(home, ".m17n.d"));
+    }
+    return directories;
+}
+
+std::string M17NDatabaseStamp(const std::string &overridePath) {
+    std::string stamp;
+    for (const auto &directory : M17NDatabaseDirectories()) {
+        AppendPathStamp(stamp, directory);
+    }
+    if (!overridePath.empty()) {
+        AppendPathStamp(stamp, overridePath);
+    }
+    return stamp;
+}
+
+std::optional<std::vector<M17NInputMethodInfo>>
+LoadInputMethodListCache(const std::string &stamp) {
+    auto file = StandardPaths::global().open(
+        StandardPathsType::PkgData, cacheFile, StandardPathsMode::User);
+    if (!file.isValid()) {
+        return std::nullopt;
+    }
+
+    IFDStreamBuf buf(file.fd());
+    std::istream in(&buf);
+    std::string line;
+    if (!std::getline(in, line) || line != cacheMagic) {
+        return std::nullopt;
+    }
+    if (!std::getline(in, line) || line != stamp) {
+        return std::nullopt;
+    }
+
+    std::vector<M17NInputMethodInfo> list;
+    while (std::getline(in, line)) {
+        auto fields = stringutils::split(line, "\t",
+                                         stringutils::SplitBehavior::KeepEmpty);
+        if (fields.size() != 6) {
+            return std::nullopt;
+        }
+        auto &info = list.emplace_back();
+        info.language = std::move(fields[0]);
+        info.name = std::move(fields[1]);
+        try {
+            info.priority = std::stoi(fields[2]);
+        } catch (const std::exception &) {
+            return std::nullopt;
+        }
+        info.deprecated = fields[3] == "1";
+        info.i18nName = std::move(fields[4]);
+        info.icon = std::move(fields[5]);
+        if (info.language.empty() || info.name.empty()) {
+            return std::nullopt;
+        }
+    }
+    return list;
+}
+
+bool SaveInputMethodListCache(const std::string &stamp,
+                              const std::vector<M17NInputMethodInfo> &list) {
+    for (const auto &info : list) {
+        if (!IsValidField(info.language) || !IsValidField(info.name) ||
+            !IsValidField(info.i18nName) || !IsValidField(info.icon)) {
+            return false;
+        }
+    }
+    return StandardPaths::global().safeSave(
+        StandardPathsType::PkgData, cacheFile, [&stamp, &list](int fd) {
+            OFDStreamBuf buf(fd);
+            std::ostream out(&buf);
+            out << cacheMagic << '\n' << stamp << '\n';
+            for (const auto &info : list) {
+                out << info.language << '\t' << info.name << '\t'
+                    << info.priority << '\t' << (info.deprecated ? 1 : 0)
+                    << '\t' << info.i18nName << '\t' << info.icon << '\n';
+            }
+            out.flush();
+            return static_cast<bool>(out);
+        });
+}
+
+} // namespace fcitx
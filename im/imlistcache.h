@@ -0,0 +1,44 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _IM_IMLISTCACHE_H_
+#define _IM_IMLISTCACHE_H_
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace fcitx {
+
+// Everything listInputMethods() needs to know about an m17n input method,
+// without touching m17n-db.
+struct M17NInputMethodInfo {
+    std::string language;
+    std::string name;
+    // Untranslated name from the override file, may be empty.
+    std::string i18nName;
+    // Icon path from m17n, empty if the input method has none.
+    std::string icon;
+    int priority = 0;
+    bool deprecated = false;
+};
+
+// Directories m17n reads its database from, in m17n's lookup order: the
+// system wide database, the application directory and the user directory.
+std::vector<std::string> M17NDatabaseDirectories();
+
+// A string that changes whenever the m17n database directories or the
+// override file at overridePath change.
+std::string M17NDatabaseStamp(const std::string &overridePath);
+
+std::optional<std::vector<M17NInputMethodInfo>>
+LoadInputMethodListCache(const std::string &stamp);
+bool SaveInputMethodListCache(const std::string &stamp,
+                              const std::vector<M17NInputMethodInfo> &list);
+
+} // namespace fcitx
+
+#endif // _IM_IMLISTCACHE_H_
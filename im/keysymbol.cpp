@@ -0,0 +1,152 @@
+/*
+ * SPDX-FileCopyrightText: 2017~2017 CSSlayer <wengxt@gmail.com>
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "keysymbol.h"
+#include "keysymname.h"
+#include <cstddef>
+#include <cstdint>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/keysym.h>
+#include <m17n-core.h>
+#include <string>
+
+namespace fcitx {
+
+namespace {
+
+// Every modifier that KeySymToSymbol looks at, anything else does not change
+// its result.
+const KeyStates relevantStates{KeyState::Shift, KeyState::Ctrl,
+                               KeyState::Mod1,  KeyState::Mod5,
+                               KeyState::Meta,  KeyState::Super,
+                               KeyState::Hyper};
+
+// Bounds the cache for clients that send arbitrary keysyms.
+constexpr size_t maxCacheSize = 4096;
+
+} // namespace
+
+MSymbol KeySymToSymbol(Key key) {
+    /*
+     Rationale:
+
+     This function converts fcitx key symbols to m17n key symbols.
+
+     Both fcitx and m17n uses X symbols to represent basic key events
+     (without modifiers). The conversion of modifier syntax is implemented in
+     this function.
+
+     The formalism provided by fcitx intended for more portable code, like
+     enums such as FCITX_BACKSPACE to represent Backspace key event, macros
+     such as FcitxHotkeyIsHotkey to do comaparision, is largely disregarded
+     here. Similiar situation for libm17n's notion of special keys like
+     msymbol("BackSpace") for Backspace key event.
+
+     MSymbol's don't need to be finalized in any way.
+     */
+
+    MSymbol mkeysym = Mnil;
+    KeyStates mask;
+
+    if (key.sym() >= FcitxKey_Shift_L && key.sym() <= FcitxKey_Hyper_R) {
+        return Mnil;
+    }
+
+    // Either a printable ASCII character or a keysym name.
+    char ascii = 0;
+
+    if (key.sym() >= FcitxKey_space && key.sym() <= FcitxKey_asciitilde) {
+        KeySym c = key.sym();
+
+        if (key.sym() == FcitxKey_space && key.states().test(KeyState::Shift)) {
+            mask |= KeyState::Shift;
+        }
+
+        if (key.states().test(KeyState::Ctrl)) {
+            if (c >= FcitxKey_a && c <= FcitxKey_z) {
+                c = static_cast<KeySym>(c + FcitxKey_A - FcitxKey_a);
+            }
+            mask |= KeyState::Ctrl;
+        }
+
+        ascii = static_cast<char>(c & 0xff);
+    } else {
+        mask |= key.states() & (KeyState::Ctrl_Shift);
+    }
+
+    mask |=
+        key.states() & KeyStates{KeyState::Mod1, KeyState::Mod5, KeyState::Meta,
+                                 KeyState::Super, KeyState::Hyper};
+
+    std::string keystr;
+
+    // and we use reverse order here comparing with other implementation since
+    // strcat is append.
+    // I don't know if it matters, but it's just to make sure it works.
+    if (mask & KeyState::Shift) {
+        keystr.append("S-");
+    }
+    if (mask & KeyState::Ctrl) {
+        keystr.append("C-");
+    }
+    if (mask & KeyState::Meta) {
+        keystr.append("M-");
+    }
+    if (mask & KeyState::Alt) {
+        keystr.append("A-");
+    }
+    // This is mysterious. - xiaq
+    if (mask & KeyState::Mod5) {
+        keystr.append("G-");
+    }
+    if (mask & KeyState::Super) {
+        keystr.append("s-");
+    }
+    if (mask & KeyState::Hyper) {
+        keystr.append("H-");
+    }
+
+    if (ascii) {
+        keystr.push_back(ascii);
+    } else if (!AppendKeySymName(keystr, key.sym())) {
+        return Mnil;
+    }
+    mkeysym = msymbol(keystr.data());
+
+    return mkeysym;
+}
+
+MSymbol KeySymbolCache::lookup(const Key &key) {
+    const KeyStates states = key.states() & relevantStates;
+    const KeySym sym = key.sym();
+    if (!states && sym >= FcitxKey_space && sym <= FcitxKey_asciitilde) {
+        if (!asciiReady_) {
+            // msymbol() may only be called after m17n is initialized, so
+            // the table can not be filled in the constructor.
+            for (size_t i = 0; i < ascii_.size(); i++) {
+                ascii_[i] = KeySymToSymbol(
+                    Key(static_cast<KeySym>(FcitxKey_space + i)));
+            }
+            asciiReady_ = true;
+        }
+        return ascii_[sym - FcitxKey_space];
+    }
+
+    const uint64_t cacheKey = (static_cast<uint64_t>(sym) << 32) |
+                              static_cast<uint32_t>(states);
+    if (auto iter = cache_.find(cacheKey); iter != cache_.end()) {
+        return iter->second;
+    }
+    if (cache_.size() >= maxCacheSize) {
+        cache_.clear();
+    }
+    MSymbol result = KeySymToSymbol(key);
+    cache_.emplace(cacheKey, result);
+    return result;
+}
+
+} // namespace fcitx
@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2017~2017 CSSlayer <wengxt@gmail.com>
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _IM_KEYSYMBOL_H_
+#define _IM_KEYSYMBOL_H_
+
+#include <array>
+#include <cstdint>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/keysym.h>
+#include <m17n-core.h>
+#include <unordered_map>
+
+namespace fcitx {
+
+// Convert a fcitx key to the m17n key symbol, or Mnil if m17n can not handle
+// it. This builds and interns the key name on every call, use KeySymbolCache
+// on the key path.
+MSymbol KeySymToSymbol(Key key);
+
+// Memoized KeySymToSymbol, keyed on the keysym and the modifiers that
+// KeySymToSymbol looks at. Unmodified printable ASCII keys hit a flat table.
+class KeySymbolCache {
+public:
+    MSymbol lookup(const Key &key);
+
+private:
+    bool asciiReady_ = false;
+    std::array<MSymbol, FcitxKey_asciitilde - FcitxKey_space + 1> ascii_{};
+    std::unordered_map<uint64_t, MSymbol> cache_;
+};
+
+} // namespace fcitx
+
+#endif // _IM_KEYSYMBOL_H_
@@ -6,26 +6,223 @@
  */
 
 #include "keysymname.h"
-#include <cstdio>
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
 #include <fcitx-utils/key.h>
 #include <fcitx-utils/keysym.h>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
 
 namespace fcitx {
-std::string KeySymName(KeySym keyval) {
-    char buf[100];
 
+namespace {
+
+// Names of the function keys (0xff00 - 0xffff), sorted by keysym. Keysyms
+// with more than one name in keysymdef.h, e.g. Prior and Page_Up, are left
+// out and resolved by Key::keySymToString() so the name stays the same.
+constexpr std::pair<KeySym, std::string_view> functionKeyNames[] = {
+    {static_cast<KeySym>(0xff08), "BackSpace"},
+    {static_cast<KeySym>(0xff09), "Tab"},
+    {static_cast<KeySym>(0xff0a), "Linefeed"},
+    {static_cast<KeySym>(0xff0b), "Clear"},
+    {static_cast<KeySym>(0xff0d), "Return"},
+    {static_cast<KeySym>(0xff13), "Pause"},
+    {static_cast<KeySym>(0xff14), "Scroll_Lock"},
+    {static_cast<KeySym>(0xff15), "Sys_Req"},
+    {static_cast<KeySym>(0xff1b), "Escape"},
+    {static_cast<KeySym>(0xff20), "Multi_key"},
+    {static_cast<KeySym>(0xff21), "Kanji"},
+    {static_cast<KeySym>(0xff22), "Muhenkan"},
+    {static_cast<KeySym>(0xff24), "Romaji"},
+    {static_cast<KeySym>(0xff25), "Hiragana"},
+    {static_cast<KeySym>(0xff26), "Katakana"},
+    {static_cast<KeySym>(0xff27), "Hiragana_Katakana"},
+    {static_cast<KeySym>(0xff28), "Zenkaku"},
+    {static_cast<KeySym>(0xff29), "Hankaku"},
+    {static_cast<KeySym>(0xff2a), "Zenkaku_Hankaku"},
+    {static_cast<KeySym>(0xff2b), "Touroku"},
+    {static_cast<KeySym>(0xff2c), "Massyo"},
+    {static_cast<KeySym>(0xff2d), "Kana_Lock"},
+    {static_cast<KeySym>(0xff2e), "Kana_Shift"},
+    {static_cast<KeySym>(0xff2f), "Eisu_Shift"},
+    {static_cast<KeySym>(0xff30), "Eisu_toggle"},
+    {static_cast<KeySym>(0xff31), "Hangul"},
+    {static_cast<KeySym>(0xff32), "Hangul_Start"},
+    {static_cast<KeySym>(0xff33), "Hangul_End"},
+    {static_cast<KeySym>(0xff34), "Hangul_Hanja"},
+    {static_cast<KeySym>(0xff35), "Hangul_Jamo"},
+    {static_cast<KeySym>(0xff36), "Hangul_Romaja"},
+    {static_cast<KeySym>(0xff38), "Hangul_Jeonja"},
+    {static_cast<KeySym>(0xff39), "Hangul_Banja"},
+    {static_cast<KeySym>(0xff3a), "Hangul_PreHanja"},
+    {static_cast<KeySym>(0xff3b), "Hangul_PostHanja"},
+    {static_cast<KeySym>(0xff3f), "Hangul_Special"},
+    {static_cast<KeySym>(0xff50), "Home"},
+    {static_cast<KeySym>(0xff51), "Left"},
+    {static_cast<KeySym>(0xff52), "Up"},
+    {static_cast<KeySym>(0xff53), "Right"},
+    {static_cast<KeySym>(0xff54), "Down"},
+    {static_cast<KeySym>(0xff57), "End"},
+    {static_cast<KeySym>(0xff58), "Begin"},
+    {static_cast<KeySym>(0xff60), "Select"},
+    {static_cast<KeySym>(0xff61), "Print"},
+    {static_cast<KeySym>(0xff62), "Execute"},
+    {static_cast<KeySym>(0xff63), "Insert"},
+    {static_cast<KeySym>(0xff65), "Undo"},
+    {static_cast<KeySym>(0xff66), "Redo"},
+    {static_cast<KeySym>(0xff67), "Menu"},
+    {static_cast<KeySym>(0xff68), "Find"},
+    {static_cast<KeySym>(0xff69), "Cancel"},
+    {static_cast<KeySym>(0xff6a), "Help"},
+    {static_cast<KeySym>(0xff6b), "Break"},
+    {static_cast<KeySym>(0xff7f), "Num_Lock"},
+    {static_cast<KeySym>(0xff80), "KP_Space"},
+    {static_cast<KeySym>(0xff89), "KP_Tab"},
+    {static_cast<KeySym>(0xff8d), "KP_Enter"},
+    {static_cast<KeySym>(0xff91), "KP_F1"},
+    {static_cast<KeySym>(0xff92), "KP_F2"},
+    {static_cast<KeySym>(0xff93), "KP_F3"},
+    {static_cast<KeySym>(0xff94), "KP_F4"},
+    {static_cast<KeySym>(0xff95), "KP_Home"},
+    {static_cast<KeySym>(0xff96), "KP_Left"},
+    {static_cast<KeySym>(0xff97), "KP_Up"},
+    {static_cast<KeySym>(0xff98), "KP_Right"},
+    {static_cast<KeySym>(0xff99), "KP_Down"},
+    {static_cast<KeySym>(0xff9c), "KP_End"},
+    {static_cast<KeySym>(0xff9d), "KP_Begin"},
+    {static_cast<KeySym>(0xff9e), "KP_Insert"},
+    {static_cast<KeySym>(0xff9f), "KP_Delete"},
+    {static_cast<KeySym>(0xffaa), "KP_Multiply"},
+    {static_cast<KeySym>(0xffab), "KP_Add"},
+    {static_cast<KeySym>(0xffac), "KP_Separator"},
+    {static_cast<KeySym>(0xffad), "KP_Subtract"},
+    {static_cast<KeySym>(0xffae), "KP_Decimal"},
+    {static_cast<KeySym>(0xffaf), "KP_Divide"},
+    {static_cast<KeySym>(0xffb0), "KP_0"},
+    {static_cast<KeySym>(0xffb1), "KP_1"},
+    {static_cast<KeySym>(0xffb2), "KP_2"},
+    {static_cast<KeySym>(0xffb3), "KP_3"},
+    {static_cast<KeySym>(0xffb4), "KP_4"},
+    {static_cast<KeySym>(0xffb5), "KP_5"},
+    {static_cast<KeySym>(0xffb6), "KP_6"},
+    {static_cast<KeySym>(0xffb7), "KP_7"},
+    {static_cast<KeySym>(0xffb8), "KP_8"},
+    {static_cast<KeySym>(0xffb9), "KP_9"},
+    {static_cast<KeySym>(0xffbd), "KP_Equal"},
+    {static_cast<KeySym>(0xffbe), "F1"},
+    {static_cast<KeySym>(0xffbf), "F2"},
+    {static_cast<KeySym>(0xffc0), "F3"},
+    {static_cast<KeySym>(0xffc1), "F4"},
+    {static_cast<KeySym>(0xffc2), "F5"},
+    {static_cast<KeySym>(0xffc3), "F6"},
+    {static_cast<KeySym>(0xffc4), "F7"},
+    {static_cast<KeySym>(0xffc5), "F8"},
+    {static_cast<KeySym>(0xffc6), "F9"},
+    {static_cast<KeySym>(0xffc7), "F10"},
+    {static_cast<KeySym>(0xffe1), "Shift_L"},
+    {static_cast<KeySym>(0xffe2), "Shift_R"},
+    {static_cast<KeySym>(0xffe3), "Control_L"},
+    {static_cast<KeySym>(0xffe4), "Control_R"},
+    {static_cast<KeySym>(0xffe5), "Caps_Lock"},
+    {static_cast<KeySym>(0xffe6), "Shift_Lock"},
+    {static_cast<KeySym>(0xffe7), "Meta_L"},
+    {static_cast<KeySym>(0xffe8), "Meta_R"},
+    {static_cast<KeySym>(0xffe9), "Alt_L"},
+    {static_cast<KeySym>(0xffea), "Alt_R"},
+    {static_cast<KeySym>(0xffeb), "Super_L"},
+    {static_cast<KeySym>(0xffec), "Super_R"},
+    {static_cast<KeySym>(0xffed), "Hyper_L"},
+    {static_cast<KeySym>(0xffee), "Hyper_R"},
+    {static_cast<KeySym>(0xfff1), "braille_dot_1"},
+    {static_cast<KeySym>(0xfff2), "braille_dot_2"},
+    {static_cast<KeySym>(0xfff3), "braille_dot_3"},
+    {static_cast<KeySym>(0xfff4), "braille_dot_4"},
+    {static_cast<KeySym>(0xfff5), "braille_dot_5"},
+    {static_cast<KeySym>(0xfff6), "braille_dot_6"},
+    {static_cast<KeySym>(0xfff7), "braille_dot_7"},
+    {static_cast<KeySym>(0xfff8), "braille_dot_8"},
+    {static_cast<KeySym>(0xfff9), "braille_dot_9"},
+    {static_cast<KeySym>(0xfffa), "braille_dot_10"},
+    {static_cast<KeySym>(0xffff), "Delete"},
+};
+
+constexpr bool IsSorted() {
+    for (size_t i = 1; i < std::size(functionKeyNames); i++) {
+        if (functionKeyNames[i - 1].first >= functionKeyNames[i].first) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(IsSorted(), "functionKeyNames must be sorted by keysym");
+
+std::string_view FunctionKeyName(KeySym keyval) {
+    const auto *end = std::end(functionKeyNames);
+    const auto *iter = std::lower_bound(
+        std::begin(functionKeyNames), end, keyval,
+        [](const auto &item, KeySym sym) { return item.first < sym; });
+    if (iter == end || iter->first != keyval) {
+        return {};
+    }
+    return iter->second;
+}
+
+void AppendHex(std::string &out, uint32_t value, int minDigits, bool upper) {
+    char buf[8];
+    auto [ptr, ec] = std::to_chars(std::begin(buf), std::end(buf), value, 16);
+    if (ec != std::errc()) {
+        return;
+    }
+    if (upper) {
+        std::transform(buf, ptr, buf, [](char c) {
+            return (c >= 'a' && c <= 'f') ? c - 'a' + 'A' : c;
+        });
+    }
+    const auto length = static_cast<int>(ptr - buf);
+    if (length < minDigits) {
+        out.append(minDigits - length, '0');
+    }
+    out.append(buf, length);
+}
+
+} // namespace
+
+bool AppendKeySymName(std::string &out, KeySym keyval) {
     /* Check for directly encoded 24-bit UCS characters: */
     if ((keyval & 0xff000000) == 0x01000000) {
-        sprintf(buf, "U+%.04X", (keyval & 0x00ffffff));
-        return buf;
+        // Same as "U+%.04X".
+        out.append("U+");
+        AppendHex(out, keyval & 0x00ffffff, 4, true);
+        return true;
+    }
+
+    if (auto name = FunctionKeyName(keyval); !name.empty()) {
+        out.append(name);
+        return true;
     }
 
     auto name = Key::keySymToString(keyval);
-    if (name.empty() && keyval != FcitxKey_None) {
-        sprintf(buf, "%#x", keyval);
-        return buf;
+    if (!name.empty()) {
+        out.append(name);
+        return true;
+    }
+    if (keyval == FcitxKey_None) {
+        return false;
     }
+    // Same as "%#x".
+    out.append("0x");
+    AppendHex(out, keyval, 1, false);
+    return true;
+}
+
+std::string KeySymName(KeySym keyval) {
+    std::string name;
+    AppendKeySymName(name, keyval);
     return name;
 }
 
@@ -12,6 +12,9 @@
 
 namespace fcitx {
 
+// Appends the m17n name of keyval to out, returns false if it has none.
+bool AppendKeySymName(std::string &out, KeySym keyval);
+
 std::string KeySymName(KeySym keyval);
 
 } // namespace fcitx
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _IM_M17N_PUBLIC_H_
+#define _IM_M17N_PUBLIC_H_
+
+#include <cstdint>
+#include <fcitx-utils/key.h>
+#include <fcitx/addoninstance.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace fcitx {
+
+// Aggregated wall clock time of one traced span.
+struct M17NSpanStats {
+    uint64_t count = 0;
+    uint64_t totalNs = 0;
+    uint64_t maxNs = 0;
+};
+
+// Counters of one m17n input method, since the addon was loaded or since the
+// last resetStatistics() call. Spans may nest, e.g. updateUI is part of
+// handleKey and includes some of textConversion.
+struct M17NInputMethodStats {
+    // Unique name of the input method, e.g. m17n_zh_pinyin.
+    std::string uniqueName;
+    // Translating the fcitx key to an m17n key symbol.
+    M17NSpanStats keySymbol;
+    M17NSpanStats handleKey;
+    M17NSpanStats filter;
+    M17NSpanStats lookup;
+    M17NSpanStats textConversion;
+    M17NSpanStats updateUI;
+    M17NSpanStats openInputMethod;
+    // Getting a context for an input context, either from the pool of idle
+    // contexts or through createInputContext.
+    M17NSpanStats acquireContext;
+    M17NSpanStats createInputContext;
+    // Current number of contexts held by input contexts and kept idle in
+    // the pool. Not affected by resetStatistics().
+    uint64_t liveContexts = 0;
+    uint64_t pooledContexts = 0;
+};
+
+} // namespace fcitx
+
+FCITX_ADDON_DECLARE_FUNCTION(M17NEngine, statistics,
+                             std::vector<fcitx::M17NInputMethodStats>());
+FCITX_ADDON_DECLARE_FUNCTION(M17NEngine, resetStatistics, void());
+
+// Run keys through the input method with the given unique name, as if they
+// were typed into an input context, and return the committed text. The
+// remaining preedit is committed at the end. Keys m17n does not handle are
+// passed through as their text. Returns std::nullopt if the input method can
+// not be opened. No InputContext or UI is involved.
+FCITX_ADDON_DECLARE_FUNCTION(
+    M17NEngine, transliterateKeys,
+    std::optional<std::string>(const std::string &uniqueName,
+                               const std::vector<fcitx::Key> &keys));
+// Same as transliterateKeys(), with one key per character of the UTF-8 text.
+FCITX_ADDON_DECLARE_FUNCTION(
+    M17NEngine, transliterate,
+    std::optional<std::string>(const std::string &uniqueName,
+                               const std::string &text));
+
+#endif // _IM_M17N_PUBLIC_H_
@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "mtextconverter.h"
+#include <cstddef>
+#include <fcitx-utils/cutf8.h>
+#include <m17n-core.h>
+#include <string>
+#include <string_view>
+
+namespace fcitx {
+
+MTextConverter::~MTextConverter() {
+    if (converter_) {
+        mconv_free_converter(converter_);
+    }
+}
+
+void MTextConverter::convert(MText *mt, std::string &out) {
+    const auto len = mtext_len(mt);
+    if (len <= 0) {
+        out.clear();
+        return;
+    }
+    // UTF-8 needs at most four bytes for a character up to U+10FFFF, and m17n
+    // never writes more than FCITX_UTF8_MAX_LENGTH for one of its own, so the
+    // text always fits.
+    const size_t bufsize = static_cast<size_t>(len) * FCITX_UTF8_MAX_LENGTH;
+    // resize() never gives capacity back, so this only allocates when the
+    // text is longer than anything converted into out before.
+    out.resize(bufsize);
+    auto *buf = reinterpret_cast<unsigned char *>(out.data());
+
+    if (converter_) {
+        mconv_reset_converter(converter_);
+        mconv_rebind_buffer(converter_, buf, static_cast<int>(bufsize));
+    } else {
+        converter_ = mconv_buffer_converter(Mcoding_utf_8, buf,
+                                            static_cast<int>(bufsize));
+        if (!converter_) {
+            out.clear();
+            return;
+        }
+    }
+
+    const int nbytes = mconv_encode(converter_, mt);
+    out.resize(nbytes > 0 ? static_cast<size_t>(nbytes) : 0);
+}
+
+std::string_view MTextConverter::convert(MText *mt) {
+    convert(mt, buffer_);
+    return buffer_;
+}
+
+void MTextConverter::convertPreedit(MText *mt, int cursor, int candidateFrom,
+                                    int candidateTo, M17NPreedit &out) {
+    out.text.clear();
+    out.cursor = -1;
+    out.segmentBegin = -1;
+    out.segmentEnd = -1;
+    const bool hasSegment = candidateFrom >= 0 && candidateFrom < candidateTo;
+    const int len = mt ? mtext_len(mt) : 0;
+    char buf[FCITX_UTF8_MAX_LENGTH + 1];
+    for (int i = 0; i <= len; i++) {
+        const int offset = static_cast<int>(out.text.size());
+        if (i == cursor) {
+            out.cursor = offset;
+        }
+        if (hasSegment && i == candidateFrom) {
+            out.segmentBegin = offset;
+        }
+        if (hasSegment && i == candidateTo && out.segmentBegin >= 0) {
+            out.segmentEnd = offset;
+        }
+        if (i == len) {
+            break;
+        }
+        const int chr = mtext_ref_char(mt, i);
+        // m17n characters go beyond Unicode, those have no UTF-8 form.
+        if (chr < 0 || chr > 0x10ffff) {
+            continue;
+        }
+        out.text.append(buf, fcitx_ucs4_to_utf8(chr, buf));
+    }
+    if (out.segmentEnd < 0) {
+        out.segmentBegin = -1;
+    }
+}
+
+} // namespace fcitx
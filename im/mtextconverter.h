@@ -0,0 +1,61 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _IM_MTEXTCONVERTER_H_
+#define _IM_MTEXTCONVERTER_H_
+
+#include <m17n-core.h>
+#include <string>
+#include <string_view>
+
+namespace fcitx {
+
+// A preedit in UTF-8. cursor and the candidate segment
+// [segmentBegin, segmentEnd) are byte offsets into text, -1 if not set.
+struct M17NPreedit {
+    std::string text;
+    int cursor = -1;
+    int segmentBegin = -1;
+    int segmentEnd = -1;
+
+    bool operator==(const M17NPreedit &other) const {
+        return text == other.text && cursor == other.cursor &&
+               segmentBegin == other.segmentBegin &&
+               segmentEnd == other.segmentEnd;
+    }
+    bool operator!=(const M17NPreedit &other) const {
+        return !(*this == other);
+    }
+};
+
+// Converts MText to UTF-8 with a single MConverter that is rebound to the
+// output buffer on every call, so steady state conversion does not allocate
+// once the output strings have grown large enough.
+class MTextConverter {
+public:
+    MTextConverter() = default;
+    ~MTextConverter();
+    MTextConverter(const MTextConverter &) = delete;
+    MTextConverter &operator=(const MTextConverter &) = delete;
+
+    // Replace the content of out with mt in UTF-8, reusing out's capacity.
+    void convert(MText *mt, std::string &out);
+    // The returned view is only valid until the next call on this converter.
+    std::string_view convert(MText *mt);
+    // Convert mt and translate the character positions cursor and
+    // [candidateFrom, candidateTo) to byte offsets in the same pass. A
+    // position outside of mt, or an empty segment, is not set in out.
+    void convertPreedit(MText *mt, int cursor, int candidateFrom,
+                        int candidateTo, M17NPreedit &out);
+
+private:
+    MConverter *converter_ = nullptr;
+    std::string buffer_;
+};
+
+} // namespace fcitx
+
+#endif // _IM_MTEXTCONVERTER_H_
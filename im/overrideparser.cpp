@@ -1,34 +1,70 @@
 /*
  * SPDX-FileCopyrightText: 2017~2017 CSSlayer <wengxt@gmail.com>
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  *
  */
 #include "overrideparser.h"
-#include <algorithm>
-#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
+#include <exception>
 #include <fcitx-utils/fdstreambuf.h>
 #include <fcitx-utils/stringutils.h>
 #include <istream>
 #include <string>
-#include <vector>
+#include <string_view>
+#include <utility>
 
 using namespace fcitx;
 
-std::vector<OverrideItem> ParseDefaultSettings(int fd) {
-    std::vector<OverrideItem> list;
+void OverrideTable::add(OverrideItem item) {
+    const auto &added = items_.emplace_back(std::move(item));
+    // try_emplace keeps the first item of each kind.
+    switch (added.wildcardCount) {
+    case 0:
+        exact_.try_emplace(Key(added.lang, added.name), &added);
+        break;
+    case 1:
+        byLang_.try_emplace(added.lang, &added);
+        break;
+    case 2:
+        byName_.try_emplace(added.name, &added);
+        break;
+    default:
+        if (!any_) {
+            any_ = &added;
+        }
+        break;
+    }
+}
+
+const OverrideItem *OverrideTable::match(std::string_view lang,
+                                         std::string_view name) const {
+    if (auto iter = exact_.find(Key(lang, name)); iter != exact_.end()) {
+        return iter->second;
+    }
+    if (auto iter = byLang_.find(lang); iter != byLang_.end()) {
+        return iter->second;
+    }
+    if (auto iter = byName_.find(name); iter != byName_.end()) {
+        return iter->second;
+    }
+    return any_;
+}
+
+OverrideTable ParseDefaultSettings(int fd) {
+    OverrideTable table;
 
     IFDStreamBuf buf(fd);
     std::istream in(&buf);
     std::string line;
     while (std::getline(in, line)) {
+        const auto trimmed = stringutils::trimView(line);
         /* ignore comments */
-        if (!line.empty() || line[0] == '#') {
+        if (trimmed.empty() || trimmed[0] == '#') {
             continue;
         }
-        const auto trimmed = stringutils::trimView(line);
         auto strList = stringutils::split(trimmed, ":");
 
         do {
@@ -38,10 +74,17 @@ std::vector<OverrideItem> ParseDefaultSettings(int fd) {
             const auto &lang = strList[0];
             const auto &name = strList[1];
             const auto &sPriority = strList[2];
+            if (lang.empty() || name.empty()) {
+                break;
+            }
 
-            int priority = std::stoi(sPriority);
-            list.emplace_back();
-            auto &item = list.back();
+            int priority;
+            try {
+                priority = std::stoi(sPriority);
+            } catch (const std::exception &) {
+                break;
+            }
+            OverrideItem item;
             item.lang = lang;
             item.name = name;
             item.priority = priority;
@@ -55,28 +98,15 @@ std::vector<OverrideItem> ParseDefaultSettings(int fd) {
             if (item.lang[0] == '*') {
                 item.wildcardCount |= 2;
             }
+            table.add(std::move(item));
         } while (0);
     }
 
-    std::stable_sort(list.begin(), list.end(),
-                     [](const auto &lhs, const auto &rhs) {
-                         return lhs.wildcardCount < rhs.wildcardCount;
-                     });
-
-    return list;
+    return table;
 }
 
-const OverrideItem *MatchDefaultSettings(const std::vector<OverrideItem> &list,
-                                         const std::string &lang,
-                                         const std::string &name) {
-    for (const auto &item : list) {
-        if (!((item.wildcardCount & 2) || lang == item.lang)) {
-            continue;
-        }
-        if (!((item.wildcardCount & 1) || name == item.name)) {
-            continue;
-        }
-        return &item;
-    }
-    return nullptr;
+const OverrideItem *MatchDefaultSettings(const OverrideTable &table,
+                                         std::string_view lang,
+                                         std::string_view name) {
+    return table.match(lang, name);
 }
@@ -1,5 +1,6 @@
 /*
  * SPDX-FileCopyrightText: 2012~2017 CSSlayer <wengxt@gmail.com>
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  *
@@ -7,9 +8,14 @@
 #ifndef _IM_OVERRIDEPARSER_H_
 #define _IM_OVERRIDEPARSER_H_
 
+#include <cstddef>
 #include <cstdio>
+#include <deque>
+#include <functional>
 #include <string>
-#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 
 struct OverrideItem {
     std::string lang;
@@ -19,9 +25,45 @@ struct OverrideItem {
     int wildcardCount;
 };
 
-std::vector<OverrideItem> ParseDefaultSettings(int fd);
-const OverrideItem *MatchDefaultSettings(const std::vector<OverrideItem> &list,
-                                         const std::string &lang,
-                                         const std::string &name);
+// Override items indexed by how they match. A lookup is at most three hash
+// lookups, in the order exact, name wildcard, lang wildcard and then both
+// wildcards. Among items of the same kind, the first one in the file wins.
+class OverrideTable {
+public:
+    OverrideTable() = default;
+    OverrideTable(OverrideTable &&) = default;
+    OverrideTable &operator=(OverrideTable &&) = default;
+    // The index points into items_.
+    OverrideTable(const OverrideTable &) = delete;
+    OverrideTable &operator=(const OverrideTable &) = delete;
+
+    void add(OverrideItem item);
+    const OverrideItem *match(std::string_view lang,
+                              std::string_view name) const;
+
+    size_t size() const { return items_.size(); }
+    bool empty() const { return items_.empty(); }
+
+private:
+    using Key = std::pair<std::string_view, std::string_view>;
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            std::hash<std::string_view> hash;
+            return hash(key.first) ^ (hash(key.second) << 1);
+        }
+    };
+
+    // A deque never moves its elements, so the views stay valid.
+    std::deque<OverrideItem> items_;
+    std::unordered_map<Key, const OverrideItem *, KeyHash> exact_;
+    std::unordered_map<std::string_view, const OverrideItem *> byLang_;
+    std::unordered_map<std::string_view, const OverrideItem *> byName_;
+    const OverrideItem *any_ = nullptr;
+};
+
+OverrideTable ParseDefaultSettings(int fd);
+const OverrideItem *MatchDefaultSettings(const OverrideTable &table,
+                                         std::string_view lang,
+                                         std::string_view name);
 
 #endif // _IM_OVERRIDEPARSER_H_
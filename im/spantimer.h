@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _IM_SPANTIMER_H_
+#define _IM_SPANTIMER_H_
+
+#include "m17n_public.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace fcitx {
+
+// Adds the time between construction and destruction to stats. Costs two
+// steady_clock reads, so it is cheap enough to stay on the key path. A null
+// stats makes it a no-op.
+class SpanTimer {
+public:
+    explicit SpanTimer(M17NSpanStats *stats)
+        : stats_(stats),
+          start_(stats ? std::chrono::steady_clock::now()
+                       : std::chrono::steady_clock::time_point()) {}
+    ~SpanTimer() {
+        if (!stats_) {
+            return;
+        }
+        const auto ns = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_)
+                .count());
+        stats_->count++;
+        stats_->totalNs += ns;
+        stats_->maxNs = std::max(stats_->maxNs, ns);
+    }
+
+    SpanTimer(const SpanTimer &) = delete;
+    SpanTimer &operator=(const SpanTimer &) = delete;
+
+private:
+    M17NSpanStats *stats_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace fcitx
+
+#endif // _IM_SPANTIMER_H_
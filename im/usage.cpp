@@ -0,0 +1,112 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "usage.h"
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <fcitx-utils/fdstreambuf.h>
+#include <fcitx-utils/standardpaths.h>
+#include <fcitx-utils/stringutils.h>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace fcitx {
+
+namespace {
+
+constexpr char usageFile[] = "m17n/usage";
+constexpr std::string_view usageMagic = "fcitx5-m17n-usage 1";
+
+} // namespace
+
+std::vector<M17NUsage> LoadUsage() {
+    std::vector<M17NUsage> usage;
+    auto file = StandardPaths::global().open(
+        StandardPathsType::PkgData, usageFile, StandardPathsMode::User);
+    if (!file.isValid()) {
+        return usage;
+    }
+
+    IFDStreamBuf buf(file.fd());
+    std::istream in(&buf);
+    std::string line;
+    if (!std::getline(in, line) || line != usageMagic) {
+        return usage;
+    }
+    while (std::getline(in, line)) {
+        auto fields = stringutils::split(line, "\t",
+                                         stringutils::SplitBehavior::KeepEmpty);
+        if (fields.size() != 4 || fields[0].empty() || fields[1].empty()) {
+            continue;
+        }
+        M17NUsage item;
+        item.language = std::move(fields[0]);
+        item.name = std::move(fields[1]);
+        try {
+            item.keys = std::stoull(fields[2]);
+            item.lastUsed = std::stoll(fields[3]);
+        } catch (const std::exception &) {
+            continue;
+        }
+        usage.push_back(std::move(item));
+    }
+    return usage;
+}
+
+bool SaveUsage(const std::vector<M17NUsage> &usage) {
+    return StandardPaths::global().safeSave(
+        StandardPathsType::PkgData, usageFile, [&usage](int fd) {
+            OFDStreamBuf buf(fd);
+            std::ostream out(&buf);
+            out << usageMagic << '\n';
+            for (const auto &item : usage) {
+                if (item.language.find_first_of("\t\n") != std::string::npos ||
+                    item.name.find_first_of("\t\n") != std::string::npos) {
+                    continue;
+                }
+                out << item.language << '\t' << item.name << '\t'
+                    << item.keys << '\t' << item.lastUsed << '\n';
+            }
+            out.flush();
+            return static_cast<bool>(out);
+        });
+}
+
+std::vector<M17NUsage> MostUsed(std::vector<M17NUsage> usage, size_t n) {
+    std::stable_sort(usage.begin(), usage.end(),
+                     [](const M17NUsage &lhs, const M17NUsage &rhs) {
+                         if (lhs.keys != rhs.keys) {
+                             return lhs.keys > rhs.keys;
+                         }
+                         return lhs.lastUsed > rhs.lastUsed;
+                     });
+    if (usage.size() > n) {
+        usage.resize(n);
+    }
+    return usage;
+}
+
+size_t HeapInUse() {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+#else
+    return 0;
+#endif
+}
+
+} // namespace fcitx
@@ -0,0 +1,37 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#ifndef _IM_USAGE_H_
+#define _IM_USAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fcitx {
+
+// How much an m17n input method has been used, kept across restarts.
+struct M17NUsage {
+    std::string language;
+    std::string name;
+    uint64_t keys = 0;
+    // Unix time of the last key.
+    int64_t lastUsed = 0;
+};
+
+std::vector<M17NUsage> LoadUsage();
+bool SaveUsage(const std::vector<M17NUsage> &usage);
+
+// The n most used input methods, by keys and then by last use.
+std::vector<M17NUsage> MostUsed(std::vector<M17NUsage> usage, size_t n);
+
+// Bytes of heap in use, or 0 if the C library can't tell.
+size_t HeapInUse();
+
+} // namespace fcitx
+
+#endif // _IM_USAGE_H_
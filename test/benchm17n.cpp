@@ -0,0 +1,304 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+
+// Replays recorded key streams through m17n input methods with the test
+// frontend and reports per key latency, together with the engine's own span
+// counters, as JSON, e.g.
+//
+//   benchm17n --repeat 50 --output result.json
+//   benchm17n m17n_zh_pinyin=/path/to/stream.keys
+//
+// Without input method arguments, the streams in test/keystreams are used.
+#include "m17n_public.h"
+#include "testdir.h"
+#include "testfrontend_public.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/stringutils.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+#include <fstream>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Stream {
+    // Alternative unique names of the same input method.
+    std::vector<std::string> inputMethods;
+    std::string path;
+};
+
+struct Result {
+    std::string inputMethod;
+    std::vector<uint64_t> latencies;
+    double totalSeconds = 0;
+    M17NInputMethodStats stats;
+};
+
+std::vector<Key> LoadKeyStream(const std::string &path) {
+    std::vector<Key> keys;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto trimmed = stringutils::trimView(line);
+        if (trimmed.empty() || trimmed[0] == '#') {
+            continue;
+        }
+        for (const auto &token :
+             stringutils::split(trimmed, FCITX_WHITESPACE)) {
+            Key key(token);
+            if (!key.isValid()) {
+                FCITX_WARN() << "Invalid key " << token << " in " << path;
+                continue;
+            }
+            keys.push_back(key);
+        }
+    }
+    return keys;
+}
+
+bool RunStream(Instance *instance, const Stream &stream, int repeat,
+               Result &result) {
+    std::string inputMethod;
+    for (const auto &name : stream.inputMethods) {
+        if (instance->inputMethodManager().entry(name)) {
+            inputMethod = name;
+            break;
+        }
+    }
+    if (inputMethod.empty()) {
+        FCITX_ERROR() << stream.inputMethods.front()
+                      << " is not available, skip it";
+        return false;
+    }
+    auto keys = LoadKeyStream(stream.path);
+    if (keys.empty()) {
+        FCITX_ERROR() << "No keys in " << stream.path;
+        return false;
+    }
+
+    auto defaultGroup = instance->inputMethodManager().currentGroup();
+    defaultGroup.inputMethodList().clear();
+    defaultGroup.inputMethodList().push_back(
+        InputMethodGroupItem("keyboard-us"));
+    defaultGroup.inputMethodList().push_back(
+        InputMethodGroupItem(inputMethod));
+    defaultGroup.setDefaultInputMethod(inputMethod);
+    instance->inputMethodManager().setGroup(defaultGroup);
+    auto *testfrontend = instance->addonManager().addon("testfrontend");
+    auto uuid = testfrontend->call<ITestFrontend::createInputContext>("bench");
+    auto *ic = instance->inputContextManager().findByUUID(uuid);
+    ic->focusIn();
+    instance->activate();
+    if (instance->inputMethod(ic) != inputMethod) {
+        FCITX_ERROR() << "Failed to activate " << inputMethod;
+        delete ic;
+        return false;
+    }
+
+    auto *m17n = instance->addonManager().addon("m17n");
+    m17n->call<IM17NEngine::resetStatistics>();
+    result.inputMethod = inputMethod;
+    result.latencies.reserve(keys.size() * repeat);
+    auto start = Clock::now();
+    for (int i = 0; i < repeat; i++) {
+        for (const auto &key : keys) {
+            auto t0 = Clock::now();
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, key, false);
+            result.latencies.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - t0)
+                    .count());
+        }
+        ic->reset();
+    }
+    result.totalSeconds =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    delete ic;
+
+    for (auto &stats : m17n->call<IM17NEngine::statistics>()) {
+        if (stats.uniqueName == inputMethod) {
+            result.stats = std::move(stats);
+        }
+    }
+    return true;
+}
+
+void SpanToJSON(std::ostream &out, const char *name,
+                const M17NSpanStats &span) {
+    out << "\"" << name << "\": {\"count\": " << span.count
+        << ", \"meanNs\": "
+        << (span.count ? static_cast<double>(span.totalNs) / span.count : 0)
+        << ", \"maxNs\": " << span.maxNs << "}";
+}
+
+uint64_t Percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+std::string ToJSON(const std::vector<Result> &results, int repeat,
+                   double startupMs) {
+    std::ostringstream out;
+    out << "{\n  \"benchmark\": \"fcitx5-m17n key latency\",\n"
+        << "  \"repeat\": " << repeat << ",\n"
+        << "  \"startupMs\": " << startupMs << ",\n  \"results\": [";
+    bool first = true;
+    for (const auto &result : results) {
+        auto sorted = result.latencies;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0;
+        for (auto latency : sorted) {
+            mean += latency;
+        }
+        if (!sorted.empty()) {
+            mean /= sorted.size();
+        }
+        const auto &stats = result.stats;
+
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "    {\n"
+            << "      \"inputMethod\": \"" << result.inputMethod << "\",\n"
+            << "      \"keys\": " << sorted.size() << ",\n"
+            << "      \"firstKeyNs\": "
+            << (result.latencies.empty() ? 0 : result.latencies.front())
+            << ",\n"
+            << "      \"totalSeconds\": " << result.totalSeconds << ",\n"
+            << "      \"keysPerSecond\": "
+            << (result.totalSeconds > 0 ? sorted.size() / result.totalSeconds
+                                        : 0)
+            << ",\n"
+            << "      \"latencyNs\": {\"mean\": " << mean
+            << ", \"p50\": " << Percentile(sorted, 0.5)
+            << ", \"p90\": " << Percentile(sorted, 0.9)
+            << ", \"p99\": " << Percentile(sorted, 0.99)
+            << ", \"max\": " << (sorted.empty() ? 0 : sorted.back()) << "},\n"
+            << "      \"spans\": {";
+        SpanToJSON(out, "keySymbol", stats.keySymbol);
+        out << ", ";
+        SpanToJSON(out, "handleKey", stats.handleKey);
+        out << ", ";
+        SpanToJSON(out, "filter", stats.filter);
+        out << ", ";
+        SpanToJSON(out, "lookup", stats.lookup);
+        out << ", ";
+        SpanToJSON(out, "textConversion", stats.textConversion);
+        out << ", ";
+        SpanToJSON(out, "updateUI", stats.updateUI);
+        out << ", ";
+        SpanToJSON(out, "openInputMethod", stats.openInputMethod);
+        out << ", ";
+        SpanToJSON(out, "acquireContext", stats.acquireContext);
+        out << ", ";
+        SpanToJSON(out, "createInputContext", stats.createInputContext);
+        out << "}\n    }";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int repeat = 20;
+    std::string output;
+    std::vector<Stream> streams;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (auto pos = arg.find('='); pos != std::string_view::npos) {
+            streams.push_back({{std::string(arg.substr(0, pos))},
+                               std::string(arg.substr(pos + 1))});
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--repeat N] [--output FILE] [IM=KEYFILE...]\n";
+            return 1;
+        }
+    }
+    if (streams.empty()) {
+        const std::string dir = TESTING_SOURCE_DIR "/test/keystreams/";
+        streams = {
+            {{"m17n_si_wijesekara", "m17n_si_wijesekera"},
+             dir + "si-wijesekara.keys"},
+            {{"m17n_zh_pinyin"}, dir + "zh-pinyin.keys"},
+            {{"m17n_hi_inscript"}, dir + "hi-inscript.keys"},
+            {{"m17n_ko_han2"}, dir + "ko-han2.keys"},
+        };
+    }
+
+    setupTestingEnvironment(TESTING_BINARY_DIR, {"bin"},
+                            {TESTING_BINARY_DIR "/test"});
+    char arg0[] = "benchm17n";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,m17n,testui";
+    char *instanceArgv[] = {arg0, arg1, arg2};
+    fcitx::Log::setLogRule("default=3");
+    Instance instance(FCITX_ARRAY_SIZE(instanceArgv), instanceArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+
+    std::vector<Result> results;
+    double startupMs = 0;
+    const auto startupBegin = Clock::now();
+    instance.eventDispatcher().schedule([&]() {
+        // Loading the addons, including listing the m17n input methods.
+        startupMs = std::chrono::duration<double, std::milli>(Clock::now() -
+                                                              startupBegin)
+                        .count();
+        auto *m17n = instance.addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        // Both Korean input methods are disabled in the override file.
+        RawConfig config;
+        config.setValueByPath("EnableDeprecated", "True");
+        m17n->setConfig(config);
+        for (const auto &stream : streams) {
+            Result result;
+            if (RunStream(&instance, stream, repeat, result)) {
+                results.push_back(std::move(result));
+            }
+        }
+        instance.exit();
+    });
+    instance.exec();
+
+    auto json = ToJSON(results, repeat, startupMs);
+    if (output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream out(output);
+        out << json;
+    }
+    return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+
+// Measures the throughput of the transliterate() addon function on a list of
+// romanized names, e.g.
+//
+//   benchtransliterate --repeat 2000 m17n_hi_itrans
+#include "m17n_public.h"
+#include "testdir.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/instance.h>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+// Romanized person and place names from India and Sri Lanka.
+const std::vector<std::string> names{
+    "raama",  "kRShNa", "sItA",    "gaNesha",  "lakShmI",   "arjuna",
+    "bhArata", "dilli", "mumbaI",  "kolkAtA",  "chennaI",   "bengaLUru",
+    "kamala", "priyA",  "anura",   "nuwara",   "kandy",     "galle",
+    "matara", "jaffna", "colombo", "sunil",    "nimal",     "kumArI",
+    "vijaya", "ashoka", "sUrya",   "chandra",  "indirA",    "mahinda"};
+
+void Run(AddonInstance *m17n, const std::string &inputMethod, int repeat) {
+    if (!m17n->call<IM17NEngine::transliterate>(inputMethod, "a")) {
+        FCITX_ERROR() << inputMethod << " is not available, skip it";
+        return;
+    }
+
+    size_t inputBytes = 0;
+    size_t outputBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; i++) {
+        for (const auto &name : names) {
+            auto result =
+                m17n->call<IM17NEngine::transliterate>(inputMethod, name);
+            inputBytes += name.size();
+            outputBytes += result ? result->size() : 0;
+        }
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+    const double calls = static_cast<double>(repeat) * names.size();
+
+    std::cout << "{\"inputMethod\": \"" << inputMethod
+              << "\", \"calls\": " << calls << ", \"seconds\": " << seconds
+              << ", \"callsPerSecond\": " << (seconds > 0 ? calls / seconds : 0)
+              << ", \"inputBytesPerSecond\": "
+              << (seconds > 0 ? inputBytes / seconds : 0)
+              << ", \"outputBytes\": " << outputBytes << "}\n";
+    FCITX_INFO() << "Sample: " << names[0] << " -> "
+                 << m17n->call<IM17NEngine::transliterate>(inputMethod,
+                                                           names[0])
+                        .value_or("");
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    int repeat = 1000;
+    std::vector<std::string> inputMethods;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc) {
+            repeat = std::max(1, std::atoi(argv[++i]));
+        } else if (!arg.empty() && arg[0] != '-') {
+            inputMethods.emplace_back(arg);
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--repeat N] [INPUT_METHOD...]\n";
+            return 1;
+        }
+    }
+    if (inputMethods.empty()) {
+        inputMethods = {"m17n_hi_itrans", "m17n_si_sayura"};
+    }
+
+    setupTestingEnvironment(TESTING_BINARY_DIR, {"bin"},
+                            {TESTING_BINARY_DIR "/test"});
+    char arg0[] = "benchtransliterate";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,m17n,testui";
+    char *instanceArgv[] = {arg0, arg1, arg2};
+    fcitx::Log::setLogRule("default=3");
+    Instance instance(FCITX_ARRAY_SIZE(instanceArgv), instanceArgv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    instance.eventDispatcher().schedule([&]() {
+        auto *m17n = instance.addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        for (const auto &inputMethod : inputMethods) {
+            Run(m17n, inputMethod, repeat);
+        }
+        instance.exit();
+    });
+    instance.exec();
+    return 0;
+}
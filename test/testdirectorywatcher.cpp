@@ -0,0 +1,75 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "directorywatcher.h"
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fcitx-utils/event.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/stringutils.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+using namespace fcitx;
+
+int main() {
+    char tmpl[] = "/tmp/testdirectorywatcherXXXXXX";
+    const char *dir = mkdtemp(tmpl);
+    FCITX_ASSERT(dir);
+    const std::string directory = dir;
+
+    EventLoop loop;
+    int calls = 0;
+    std::unordered_set<std::string> changed;
+    DirectoryWatcher watcher(
+        &loop,
+        [&calls, &changed](const std::unordered_set<std::string> &paths) {
+            calls++;
+            changed.insert(paths.begin(), paths.end());
+        },
+        100000);
+    if (!watcher.addDirectory(directory)) {
+        FCITX_ERROR() << "inotify is not available, skip the test";
+        std::filesystem::remove_all(directory);
+        return 0;
+    }
+    FCITX_ASSERT(!watcher.addDirectory(directory + "/missing"));
+
+    const auto created = stringutils::joinPath(directory, "xx-new.mim");
+    const auto removed = stringutils::joinPath(directory, "xx-old.mim");
+    std::ofstream(removed) << "old";
+    std::unique_ptr<EventSourceTime> step;
+    std::unique_ptr<EventSourceTime> finish;
+    // Let the creation of xx-old.mim be reported first.
+    step = loop.addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + 300000, 0,
+        [&](EventSourceTime *, uint64_t) {
+            FCITX_ASSERT(calls == 1) << calls;
+            FCITX_ASSERT(changed.count(removed));
+            changed.clear();
+            // Both changes fall into one delay and are reported together.
+            std::ofstream(created) << "new";
+            std::filesystem::remove(removed);
+            return true;
+        });
+    finish = loop.addTimeEvent(CLOCK_MONOTONIC,
+                               now(CLOCK_MONOTONIC) + 800000, 0,
+                               [&](EventSourceTime *, uint64_t) {
+                                   loop.exit();
+                                   return true;
+                               });
+    loop.exec();
+
+    FCITX_ASSERT(calls == 2) << calls;
+    FCITX_ASSERT(changed.count(created));
+    FCITX_ASSERT(changed.count(removed));
+    std::filesystem::remove_all(directory);
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "keysymbol.h"
+#include <cstdint>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/keysym.h>
+#include <fcitx-utils/log.h>
+#include <m17n-core.h>
+#include <m17n.h>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+void checkKey(KeySymbolCache &cache, const Key &key) {
+    MSymbol expected = KeySymToSymbol(key);
+    // First lookup fills the cache, the second one must hit it.
+    MSymbol cached = cache.lookup(key);
+    FCITX_ASSERT(cached == expected)
+        << key << " " << (expected ? msymbol_name(expected) : "(null)");
+    FCITX_ASSERT(cache.lookup(key) == expected) << key;
+}
+
+} // namespace
+
+int main() {
+    M17N_INIT();
+
+    const KeyState modifiers[] = {
+        KeyState::Shift, KeyState::CapsLock, KeyState::Ctrl,
+        KeyState::Alt,   KeyState::NumLock,  KeyState::Hyper,
+        KeyState::Super, KeyState::Mod5,     KeyState::Super2,
+        KeyState::Hyper2, KeyState::Meta,    KeyState::Repeat};
+    constexpr uint32_t modifierCount = sizeof(modifiers) / sizeof(modifiers[0]);
+
+    // Every combination of modifiers, including the ones that are ignored.
+    std::vector<KeyStates> allStates;
+    for (uint32_t bits = 0; bits < (1U << modifierCount); bits++) {
+        KeyStates states;
+        for (uint32_t i = 0; i < modifierCount; i++) {
+            if (bits & (1U << i)) {
+                states |= modifiers[i];
+            }
+        }
+        allStates.push_back(states);
+    }
+    const std::vector<KeyStates> commonStates{
+        KeyStates(),
+        KeyStates{KeyState::Shift},
+        KeyStates{KeyState::Ctrl},
+        KeyStates{KeyState::Ctrl, KeyState::Shift},
+        KeyStates{KeyState::Alt},
+        KeyStates{KeyState::Alt, KeyState::CapsLock, KeyState::NumLock},
+        KeyStates{KeyState::Super, KeyState::Hyper, KeyState::Meta,
+                  KeyState::Mod5}};
+
+    KeySymbolCache cache;
+    // Printable ASCII goes through the flat table when unmodified.
+    for (uint32_t sym = FcitxKey_space; sym <= FcitxKey_asciitilde; sym++) {
+        for (const auto &states : allStates) {
+            checkKey(cache, Key(static_cast<KeySym>(sym), states));
+        }
+    }
+
+    // Keys with a name, modifiers and a few keys with special handling.
+    const KeySym namedKeys[] = {
+        FcitxKey_None,      FcitxKey_BackSpace, FcitxKey_Tab,
+        FcitxKey_Return,    FcitxKey_Escape,    FcitxKey_Delete,
+        FcitxKey_Left,      FcitxKey_Up,        FcitxKey_Right,
+        FcitxKey_Down,      FcitxKey_Home,      FcitxKey_End,
+        FcitxKey_Page_Up,   FcitxKey_Page_Down, FcitxKey_F1,
+        FcitxKey_KP_Enter,  FcitxKey_KP_1,      FcitxKey_Shift_L,
+        FcitxKey_Control_R, FcitxKey_Alt_L,     FcitxKey_Hyper_R,
+        FcitxKey_Caps_Lock, FcitxKey_Hangul,    FcitxKey_Muhenkan,
+        FcitxKey_nobreakspace, FcitxKey_eacute, FcitxKey_EuroSign};
+    for (auto sym : namedKeys) {
+        for (const auto &states : allStates) {
+            checkKey(cache, Key(sym, states));
+        }
+    }
+
+    // Every 16 bit keysym and a slice of the Unicode keysyms.
+    for (uint32_t sym = 0; sym <= 0xffff; sym++) {
+        for (const auto &states : commonStates) {
+            checkKey(cache, Key(static_cast<KeySym>(sym), states));
+        }
+    }
+    for (uint32_t sym = 0x1000000; sym <= 0x1000000 + 0x3000; sym++) {
+        checkKey(cache, Key(static_cast<KeySym>(sym)));
+    }
+    checkKey(cache, Key(static_cast<KeySym>(0x110ffff)));
+    checkKey(cache, Key(static_cast<KeySym>(0xfffffff)));
+
+    M17N_FINI();
+    return 0;
+}
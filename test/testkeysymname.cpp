@@ -0,0 +1,65 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "keysymname.h"
+#include <cstdint>
+#include <cstdio>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/keysym.h>
+#include <fcitx-utils/log.h>
+#include <string>
+
+using namespace fcitx;
+
+namespace {
+
+// The sprintf based implementation that the table replaces, kept as the
+// reference.
+std::string ReferenceKeySymName(KeySym keyval) {
+    char buf[100];
+
+    if ((keyval & 0xff000000) == 0x01000000) {
+        sprintf(buf, "U+%.04X", (keyval & 0x00ffffff));
+        return buf;
+    }
+
+    auto name = Key::keySymToString(keyval);
+    if (name.empty() && keyval != FcitxKey_None) {
+        sprintf(buf, "%#x", keyval);
+        return buf;
+    }
+    return name;
+}
+
+void Check(uint32_t value) {
+    auto keyval = static_cast<KeySym>(value);
+    auto expect = ReferenceKeySymName(keyval);
+    FCITX_ASSERT(KeySymName(keyval) == expect)
+        << value << " " << KeySymName(keyval) << " " << expect;
+
+    std::string out = "C-";
+    FCITX_ASSERT(AppendKeySymName(out, keyval) == !expect.empty());
+    FCITX_ASSERT(out == "C-" + expect) << out;
+}
+
+} // namespace
+
+int main() {
+    // Every keysym below the Unicode range, which covers all named keysyms.
+    for (uint32_t value = 0; value < 0x1000000; value++) {
+        Check(value);
+    }
+    // The Unicode range, every code point of the BMP and a sample above.
+    for (uint32_t value = 0x1000000; value <= 0x1010000; value++) {
+        Check(value);
+    }
+    for (uint32_t value = 0x1010000; value <= 0x1ffffff; value += 0xfff) {
+        Check(value);
+    }
+    Check(0x110ffff);
+    Check(0xffffffff);
+    return 0;
+}
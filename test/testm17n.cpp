@@ -4,8 +4,13 @@
  * SPDX-License-Identifier: LGPL-2.1-or-later
  *
  */
+#include "m17n_public.h"
 #include "testdir.h"
 #include "testfrontend_public.h"
+#include <cstdlib>
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/event.h>
 #include <fcitx-utils/eventdispatcher.h>
 #include <fcitx-utils/key.h>
 #include <fcitx-utils/keysym.h>
@@ -13,15 +18,89 @@
 #include <fcitx-utils/macros.h>
 #include <fcitx-utils/testing.h>
 #include <fcitx/addonmanager.h>
+#include <fcitx/candidatelist.h>
+#include <fcitx/event.h>
 #include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodengine.h>
+#include <fcitx/inputmethodentry.h>
 #include <fcitx/inputmethodgroup.h>
 #include <fcitx/inputmethodmanager.h>
 #include <fcitx/inputpanel.h>
 #include <fcitx/instance.h>
+#include <fcitx/text.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
 #include <string>
+#include <vector>
 
 using namespace fcitx;
 
+// "k" starts a preedit, "j" replaces it with "K" without moving the cursor
+// and "z" is taken without changing anything.
+constexpr char coalesceTestMim[] = R"((input-method t coalesce-test)
+(description "Keeps a preedit that keys may leave unchanged.")
+(title "CT")
+(map
+ (start
+  ("k" "k"))
+ (edit
+  ("j" (delete @<) "K")
+  ("z")))
+(state
+ (init
+  (start (shift edit)))
+ (edit
+  (edit (shift edit))))
+)";
+
+// Two groups of candidates, moved through with Left and Right only. Up and
+// Down are not bound, so they commit the current candidate.
+constexpr char selectTestMim[] = R"((input-method t select-test)
+(description "Candidates without Up and Down.")
+(title "SE")
+(map
+ (start
+  ("a" ("abcde" "fghij")))
+ (choose
+  ((Left) (select @-) (shift choose))
+  ((Right) (select @+) (shift choose))
+  ("1" (select 0) (shift init))
+  ("2" (select 1) (shift init))
+  ("3" (select 2) (shift init))
+  ("4" (select 3) (shift init))
+  ("5" (select 4) (shift init))))
+(state
+ (init
+  (start (shift choose)))
+ (choose
+  (choose)))
+)";
+
+// Installed while the engine runs.
+constexpr char newTestMim[] = R"((input-method t new-test)
+(description "Installed while the test runs.")
+(title "NT")
+(map
+ (trans
+  ("a" "A")))
+(state
+ (init
+  (trans)))
+)";
+
+// m17n also reads the input methods in ~/.m17n.d.
+const std::filesystem::path userDatabase =
+    TESTING_BINARY_DIR "/test/m17n-home/.m17n.d";
+
+void setupHome() {
+    std::filesystem::create_directories(userDatabase);
+    std::ofstream(userDatabase / "t-coalesce-test.mim") << coalesceTestMim;
+    std::ofstream(userDatabase / "t-select-test.mim") << selectTestMim;
+    std::filesystem::remove(userDatabase / "t-new-test.mim");
+    setenv("HOME", userDatabase.parent_path().c_str(), 1);
+}
+
 void testWijesekara(Instance *instance) {
     instance->eventDispatcher().schedule([instance]() {
         auto *m17n = instance->addonManager().addon("m17n", true);
@@ -73,6 +152,41 @@ void testWijesekara(Instance *instance) {
     });
 }
 
+void testStatistics(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_si_wijesekera") &&
+            !instance->inputMethodManager().entry("m17n_si_wijesekara")) {
+            FCITX_ERROR()
+                << "wijesekara engine is not available, skip the test";
+            return;
+        }
+        // testWijesekara typed into the input method before.
+        bool found = false;
+        for (const auto &stats : m17n->call<IM17NEngine::statistics>()) {
+            if (stats.uniqueName != "m17n_si_wijesekera" &&
+                stats.uniqueName != "m17n_si_wijesekara") {
+                continue;
+            }
+            found = true;
+            FCITX_ASSERT(stats.openInputMethod.count == 1);
+            FCITX_ASSERT(stats.acquireContext.count >= 1);
+            FCITX_ASSERT(stats.handleKey.count >= 5) << stats.handleKey.count;
+            FCITX_ASSERT(stats.filter.count == stats.handleKey.count);
+            FCITX_ASSERT(stats.updateUI.count >= stats.handleKey.count);
+            FCITX_ASSERT(stats.handleKey.maxNs <= stats.handleKey.totalNs);
+        }
+        FCITX_ASSERT(found);
+        m17n->call<IM17NEngine::resetStatistics>();
+        for (const auto &stats : m17n->call<IM17NEngine::statistics>()) {
+            FCITX_ASSERT(!stats.uniqueName.empty());
+            FCITX_ASSERT(stats.handleKey.count == 0);
+            FCITX_ASSERT(stats.handleKey.totalNs == 0);
+        }
+    });
+}
+
 void testSwitchWithUnicode(Instance *instance) {
     instance->eventDispatcher().schedule(
         [instance]() {
@@ -117,7 +231,446 @@ void testSwitchWithUnicode(Instance *instance) {
         });
 }
 
+void testSelectCandidate(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_zh_pinyin")) {
+            FCITX_ERROR() << "zh-pinyin engine is not available, skip the test";
+            return;
+        }
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_zh_pinyin"));
+        defaultGroup.setDefaultInputMethod("m17n_zh_pinyin");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->focusIn();
+        instance->activate();
+        FCITX_ASSERT(instance->inputMethod(ic) == "m17n_zh_pinyin");
+
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("y"), false);
+        auto candidateList = ic->inputPanel().candidateList();
+        if (!candidateList || !candidateList->toBulk()) {
+            FCITX_ERROR() << "zh-pinyin shows no candidates, skip the test";
+            delete ic;
+            return;
+        }
+        auto *bulk = candidateList->toBulk();
+        FCITX_ASSERT(bulk->totalSize() > 0);
+        // Pick the last candidate, which is usually a few pages away.
+        const int index = bulk->totalSize() - 1;
+        const auto &word = bulk->candidateFromAll(index);
+        testfrontend->call<ITestFrontend::pushCommitExpectation>(
+            word.text().toString());
+
+        int uiUpdates = 0;
+        int preeditUpdates = 0;
+        auto uiWatcher = instance->watchEvent(
+            EventType::InputContextUpdateUI, EventWatcherPhase::Default,
+            [&uiUpdates](Event &) { uiUpdates++; });
+        auto preeditWatcher = instance->watchEvent(
+            EventType::InputContextUpdatePreedit, EventWatcherPhase::Default,
+            [&preeditUpdates](Event &) { preeditUpdates++; });
+        word.select(ic);
+        FCITX_INFO() << "Selecting candidate " << index << " took "
+                     << uiUpdates << " UI updates and " << preeditUpdates
+                     << " preedit updates";
+        FCITX_ASSERT(uiUpdates <= 1) << uiUpdates;
+        FCITX_ASSERT(preeditUpdates <= 1) << preeditUpdates;
+        delete ic;
+    });
+}
+
+// Selecting a candidate in another group must not use Up and Down where they
+// don't move between groups.
+void testSelectCandidateWithoutGroupKeys(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        if (!instance->inputMethodManager().entry("m17n_t_select-test")) {
+            FCITX_ERROR() << "select-test engine is not available, skip "
+                             "the test";
+            return;
+        }
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_t_select-test"));
+        defaultGroup.setDefaultInputMethod("m17n_t_select-test");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->focusIn();
+        instance->activate();
+        FCITX_ASSERT(instance->inputMethod(ic) == "m17n_t_select-test");
+
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+        auto candidateList = ic->inputPanel().candidateList();
+        FCITX_ASSERT(candidateList && candidateList->toBulk());
+        auto *bulk = candidateList->toBulk();
+        FCITX_ASSERT(bulk->totalSize() == 10) << bulk->totalSize();
+        // "h", the third candidate of the second group.
+        const auto &word = bulk->candidateFromAll(7);
+        FCITX_ASSERT(word.text().toString() == "h");
+        testfrontend->call<ITestFrontend::pushCommitExpectation>("h");
+        word.select(ic);
+        FCITX_ASSERT(ic->inputPanel().preedit().empty());
+        FCITX_ASSERT(ic->inputPanel().clientPreedit().empty());
+        delete ic;
+    });
+}
+
+void testReuseContext(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_zh_pinyin")) {
+            FCITX_ERROR() << "zh-pinyin engine is not available, skip the test";
+            return;
+        }
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_zh_pinyin"));
+        defaultGroup.setDefaultInputMethod("m17n_zh_pinyin");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        m17n->call<IM17NEngine::resetStatistics>();
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        for (int i = 0; i < 3; i++) {
+            auto uuid = testfrontend->call<ITestFrontend::createInputContext>(
+                "testapp");
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            ic->focusIn();
+            instance->activate();
+            FCITX_ASSERT(instance->inputMethod(ic) == "m17n_zh_pinyin");
+            for (int j = 0; j < 3; j++) {
+                testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("y"),
+                                                            false);
+                ic->reset();
+                FCITX_ASSERT(ic->inputPanel().preedit().empty());
+                FCITX_ASSERT(ic->inputPanel().clientPreedit().empty());
+            }
+            delete ic;
+        }
+        // Resets keep the context, and a new input context reuses the one of
+        // the deleted input context.
+        for (const auto &stats : m17n->call<IM17NEngine::statistics>()) {
+            if (stats.uniqueName == "m17n_zh_pinyin") {
+                FCITX_ASSERT(stats.acquireContext.count == 3)
+                    << stats.acquireContext.count;
+                FCITX_ASSERT(stats.createInputContext.count <= 1)
+                    << stats.createInputContext.count;
+            }
+        }
+    });
+}
+
+void testPrepareOnActivate(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_zh_pinyin")) {
+            FCITX_ERROR() << "zh-pinyin engine is not available, skip the test";
+            return;
+        }
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_zh_pinyin"));
+        defaultGroup.setDefaultInputMethod("m17n_zh_pinyin");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        m17n->call<IM17NEngine::resetStatistics>();
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->focusIn();
+        instance->activate();
+        FCITX_ASSERT(instance->inputMethod(ic) == "m17n_zh_pinyin");
+
+        // Runs after the preparation scheduled by activate().
+        instance->eventDispatcher().schedule([instance, m17n, uuid]() {
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            FCITX_ASSERT(ic);
+            bool prepared = false;
+            for (const auto &stats : m17n->call<IM17NEngine::statistics>()) {
+                if (stats.uniqueName == "m17n_zh_pinyin") {
+                    prepared = stats.acquireContext.count > 0 &&
+                               stats.handleKey.count == 0;
+                }
+            }
+            FCITX_ASSERT(prepared);
+            delete ic;
+        });
+    });
+}
+
+void testCoalesceUIUpdates(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_zh_pinyin")) {
+            FCITX_ERROR() << "zh-pinyin engine is not available, skip the test";
+            return;
+        }
+        RawConfig config;
+        config.setValueByPath("CoalesceUIUpdates", "True");
+        m17n->setConfig(config);
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_zh_pinyin"));
+        defaultGroup.setDefaultInputMethod("m17n_zh_pinyin");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->focusIn();
+        instance->activate();
+        FCITX_ASSERT(instance->inputMethod(ic) == "m17n_zh_pinyin");
+
+        auto preeditUpdates = std::make_shared<int>(0);
+        auto watcher = std::shared_ptr<HandlerTableEntry<EventHandler>>(
+            instance->watchEvent(
+                EventType::InputContextUpdatePreedit,
+                EventWatcherPhase::Default,
+                [preeditUpdates](Event &) { (*preeditUpdates)++; }));
+        for (const char *key : {"n", "i", "h", "a", "o"}) {
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key(key), false);
+        }
+        FCITX_ASSERT(*preeditUpdates == 0) << *preeditUpdates;
+
+        // Runs after the update scheduled by the keys.
+        instance->eventDispatcher().schedule(
+            [instance, m17n, uuid, preeditUpdates, watcher]() {
+                FCITX_ASSERT(*preeditUpdates == 1) << *preeditUpdates;
+                auto *ic = instance->inputContextManager().findByUUID(uuid);
+                FCITX_ASSERT(ic);
+                delete ic;
+                RawConfig config;
+                config.setValueByPath("CoalesceUIUpdates", "False");
+                m17n->setConfig(config);
+            });
+    });
+}
+
+// A key that changes nothing must not hide the changes of the keys coalesced
+// before it, m17n forgets them in every minput_filter().
+void testCoalesceUnchangedKey(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_t_coalesce-test")) {
+            FCITX_ERROR() << "coalesce-test engine is not available, skip "
+                             "the test";
+            return;
+        }
+        RawConfig config;
+        config.setValueByPath("CoalesceUIUpdates", "True");
+        m17n->setConfig(config);
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_t_coalesce-test"));
+        defaultGroup.setDefaultInputMethod("m17n_t_coalesce-test");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->setCapabilityFlags(CapabilityFlags{});
+        ic->focusIn();
+        instance->activate();
+        FCITX_ASSERT(instance->inputMethod(ic) == "m17n_t_coalesce-test");
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("k"), false);
+
+        instance->eventDispatcher().schedule([instance, testfrontend, uuid]() {
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            FCITX_ASSERT(ic);
+            FCITX_ASSERT(ic->inputPanel().preedit().toString() == "k")
+                << ic->inputPanel().preedit().toString();
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("j"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("z"), false);
+
+            instance->eventDispatcher().schedule([instance, uuid]() {
+                auto *ic = instance->inputContextManager().findByUUID(uuid);
+                FCITX_ASSERT(ic);
+                FCITX_ASSERT(ic->inputPanel().preedit().toString() == "K")
+                    << ic->inputPanel().preedit().toString();
+                delete ic;
+                auto *m17n = instance->addonManager().addon("m17n", true);
+                RawConfig config;
+                config.setValueByPath("CoalesceUIUpdates", "False");
+                m17n->setConfig(config);
+            });
+        });
+    });
+}
+
+void testStatus(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_t_latn-pre")) {
+            FCITX_ERROR() << "latn-pre engine is not available, skip the test";
+            return;
+        }
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_t_latn-pre"));
+        defaultGroup.setDefaultInputMethod("m17n_t_latn-pre");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->focusIn();
+        instance->activate();
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("x"), false);
+        const auto *entry = instance->inputMethodEntry(ic);
+        auto *engine = instance->inputMethodEngine(ic);
+        FCITX_ASSERT(entry && engine);
+        // m17n starts with the title of the input method as its status.
+        auto status = engine->subMode(*entry, *ic);
+        FCITX_ASSERT(!status.empty());
+        FCITX_ASSERT(engine->subModeLabel(*entry, *ic) == status);
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("apostrophe"),
+                                                    false);
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("e"), false);
+        FCITX_ASSERT(engine->subMode(*entry, *ic) == status);
+        delete ic;
+    });
+}
+
+void testEnableDeprecated(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        auto &manager = instance->inputMethodManager();
+        // zh-py is deprecated in the override file.
+        FCITX_ASSERT(!manager.entry("m17n_zh_py"));
+        RawConfig config;
+        config.setValueByPath("EnableDeprecated", "True");
+        m17n->setConfig(config);
+        if (!manager.entry("m17n_zh_py")) {
+            FCITX_ERROR() << "zh-py engine is not available, skip the test";
+        } else {
+            FCITX_ASSERT(manager.entry("m17n_zh_py")->addon() == "m17n");
+        }
+        config.setValueByPath("EnableDeprecated", "False");
+        m17n->setConfig(config);
+    });
+}
+
+void testTransliterate(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        FCITX_ASSERT(!m17n->call<IM17NEngine::transliterate>("m17n_xx_none",
+                                                             "abc"));
+        FCITX_ASSERT(
+            !m17n->call<IM17NEngine::transliterate>("keyboard-us", "abc"));
+        if (!instance->inputMethodManager().entry("m17n_t_latn-pre")) {
+            FCITX_ERROR() << "latn-pre engine is not available, skip the test";
+            return;
+        }
+        auto result = m17n->call<IM17NEngine::transliterate>(
+            "m17n_t_latn-pre", "caf'e na\"ive");
+        FCITX_ASSERT(result);
+        FCITX_ASSERT(*result == "café naïve") << *result;
+        // The context goes back to the pool in its initial state.
+        result = m17n->call<IM17NEngine::transliterate>("m17n_t_latn-pre",
+                                                        "'");
+        FCITX_ASSERT(result);
+        FCITX_ASSERT(*result == "'") << *result;
+        result = m17n->call<IM17NEngine::transliterateKeys>(
+            "m17n_t_latn-pre",
+            std::vector<Key>{Key("apostrophe"), Key("e"), Key("x")});
+        FCITX_ASSERT(result);
+        FCITX_ASSERT(*result == "éx") << *result;
+    });
+}
+
+// Installing an input method leaves the others alone. Exits the instance
+// once the engine has seen the new file.
+void newInputMethodFile(Instance *instance) {
+    if (!instance->inputMethodManager().entry("m17n_t_coalesce-test")) {
+        FCITX_ERROR() << "coalesce-test engine is not available, skip the test";
+        instance->exit();
+        return;
+    }
+    auto defaultGroup = instance->inputMethodManager().currentGroup();
+    defaultGroup.inputMethodList().clear();
+    defaultGroup.inputMethodList().push_back(
+        InputMethodGroupItem("keyboard-us"));
+    defaultGroup.inputMethodList().push_back(
+        InputMethodGroupItem("m17n_t_coalesce-test"));
+    defaultGroup.setDefaultInputMethod("m17n_t_coalesce-test");
+    instance->inputMethodManager().setGroup(defaultGroup);
+    auto *testfrontend = instance->addonManager().addon("testfrontend");
+    auto uuid =
+        testfrontend->call<ITestFrontend::createInputContext>("testapp");
+    auto *ic = instance->inputContextManager().findByUUID(uuid);
+    ic->setCapabilityFlags(CapabilityFlags{});
+    ic->focusIn();
+    instance->activate();
+    FCITX_ASSERT(instance->inputMethod(ic) == "m17n_t_coalesce-test");
+    testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("k"), false);
+    FCITX_ASSERT(ic->inputPanel().preedit().toString() == "k");
+
+    std::ofstream(userDatabase / "t-new-test.mim") << newTestMim;
+    // The engine hears of database changes after half a second.
+    auto timer = std::make_shared<std::unique_ptr<EventSourceTime>>();
+    *timer = instance->eventLoop().addTimeEvent(
+        CLOCK_MONOTONIC, now(CLOCK_MONOTONIC) + 2000000, 0,
+        [instance, uuid, timer](EventSourceTime *, uint64_t) {
+            if (!instance->inputMethodManager().entry("m17n_t_new-test")) {
+                FCITX_ERROR() << "new-test engine was not listed";
+            }
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            FCITX_ASSERT(ic);
+            FCITX_ASSERT(ic->inputPanel().preedit().toString() == "k")
+                << ic->inputPanel().preedit().toString();
+            delete ic;
+            instance->eventDispatcher().schedule([timer]() { timer->reset(); });
+            instance->exit();
+            return true;
+        });
+}
+
+void testNewInputMethodFile(Instance *instance) {
+    // Let the callbacks scheduled by the other tests run first.
+    instance->eventDispatcher().schedule([instance]() {
+        instance->eventDispatcher().schedule([instance]() {
+            instance->eventDispatcher().schedule(
+                [instance]() { newInputMethodFile(instance); });
+        });
+    });
+}
+
 int main() {
+    setupHome();
     setupTestingEnvironment(TESTING_BINARY_DIR, {"bin"},
                             {TESTING_BINARY_DIR "/test"});
     // fcitx::Log::setLogRule("default=5,table=5,libime-table=5");
@@ -129,8 +682,18 @@ int main() {
     Instance instance(FCITX_ARRAY_SIZE(argv), argv);
     instance.addonManager().registerDefaultLoader(nullptr);
     testWijesekara(&instance);
+    testStatistics(&instance);
     testSwitchWithUnicode(&instance);
-    instance.eventDispatcher().schedule([&instance]() { instance.exit(); });
+    testSelectCandidate(&instance);
+    testSelectCandidateWithoutGroupKeys(&instance);
+    testReuseContext(&instance);
+    testPrepareOnActivate(&instance);
+    testCoalesceUIUpdates(&instance);
+    testCoalesceUnchangedKey(&instance);
+    testStatus(&instance);
+    testEnableDeprecated(&instance);
+    testTransliterate(&instance);
+    testNewInputMethodFile(&instance);
     instance.exec();
 
     return 0;
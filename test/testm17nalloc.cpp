@@ -0,0 +1,161 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+
+// Counts the m17n objects the addon allocates while typing. The functions
+// below take the place of the ones in libm17n for every caller, since the
+// executable exports them.
+#include "testdir.h"
+#include "testfrontend_public.h"
+#include <cstring>
+#include <dlfcn.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+#include <m17n-core.h>
+#include <m17n.h>
+#include <string>
+
+using namespace fcitx;
+
+namespace {
+
+int allocations = 0;
+
+// Only count the objects allocated by the addon, not the ones m17n
+// allocates for itself.
+void CountAllocation(void *caller) {
+    Dl_info info;
+    if (dladdr(caller, &info) && info.dli_fname &&
+        std::strstr(info.dli_fname, "libm17n")) {
+        return;
+    }
+    allocations++;
+}
+
+template <typename T>
+T Real(const char *name) {
+    return reinterpret_cast<T>(dlsym(RTLD_NEXT, name));
+}
+
+} // namespace
+
+extern "C" {
+
+MText *mtext() {
+    static auto *real = Real<MText *(*)()>("mtext");
+    CountAllocation(__builtin_return_address(0));
+    return real();
+}
+
+MText *mtext_dup(MText *mt) {
+    static auto *real = Real<MText *(*)(MText *)>("mtext_dup");
+    CountAllocation(__builtin_return_address(0));
+    return real(mt);
+}
+
+MText *mtext_duplicate(MText *mt, int from, int to) {
+    static auto *real =
+        Real<MText *(*)(MText *, int, int)>("mtext_duplicate");
+    CountAllocation(__builtin_return_address(0));
+    return real(mt, from, to);
+}
+
+MText *mconv_decode_buffer(MSymbol name, const unsigned char *buf, int n) {
+    static auto *real = Real<MText *(*)(MSymbol, const unsigned char *, int)>(
+        "mconv_decode_buffer");
+    CountAllocation(__builtin_return_address(0));
+    return real(name, buf, n);
+}
+
+MConverter *mconv_buffer_converter(MSymbol name, const unsigned char *buf,
+                                   int n) {
+    static auto *real =
+        Real<MConverter *(*)(MSymbol, const unsigned char *, int)>(
+            "mconv_buffer_converter");
+    CountAllocation(__builtin_return_address(0));
+    return real(name, buf, n);
+}
+}
+
+namespace {
+
+// Keys that latn-pre lets through without a preedit.
+constexpr const char *passthroughKeys[] = {"x", "y", "z", "1", "2", "space",
+                                           "F5"};
+
+void testPassthroughKeys(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry("m17n_t_latn-pre")) {
+            FCITX_ERROR() << "latn-pre engine is not available, skip the test";
+            return;
+        }
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("m17n_t_latn-pre"));
+        defaultGroup.setDefaultInputMethod("m17n_t_latn-pre");
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->focusIn();
+        instance->activate();
+        FCITX_ASSERT(instance->inputMethod(ic) == "m17n_t_latn-pre");
+
+        // The first keys create the scratch objects.
+        allocations = 0;
+        for (const auto *key : passthroughKeys) {
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key(key), false);
+        }
+        if (allocations == 0) {
+            FCITX_WARN() << "m17n functions are not interposed, skip the test";
+            delete ic;
+            return;
+        }
+
+        allocations = 0;
+        for (int i = 0; i < 100; i++) {
+            for (const auto *key : passthroughKeys) {
+                testfrontend->call<ITestFrontend::keyEvent>(uuid, Key(key),
+                                                            false);
+            }
+        }
+        FCITX_ASSERT(allocations == 0) << allocations;
+        delete ic;
+    });
+}
+
+} // namespace
+
+int main() {
+    setupTestingEnvironment(TESTING_BINARY_DIR, {"bin"},
+                            {TESTING_BINARY_DIR "/test"});
+    char arg0[] = "testm17nalloc";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,m17n,testui";
+    char *argv[] = {arg0, arg1, arg2};
+    fcitx::Log::setLogRule("default=5,m17n=5");
+    Instance instance(FCITX_ARRAY_SIZE(argv), argv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    testPassthroughKeys(&instance);
+    instance.eventDispatcher().schedule([&instance]() { instance.exit(); });
+    instance.exec();
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "m17n_public.h"
+#include "testdir.h"
+#include "testfrontend_public.h"
+#include "usage.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontext.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+#include <string>
+
+using namespace fcitx;
+
+namespace {
+
+constexpr int maxContexts = 8;
+constexpr int openInputContexts = 50;
+constexpr int rounds = 3000;
+
+M17NInputMethodStats StatsOf(AddonInstance *m17n, const std::string &name) {
+    for (auto &stats : m17n->call<IM17NEngine::statistics>()) {
+        if (stats.uniqueName == name) {
+            return stats;
+        }
+    }
+    return {};
+}
+
+// Keep many input contexts open and churn through thousands of them, the
+// number of m17n contexts and the heap must stay bounded.
+void testChurn(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        const std::string name = "m17n_zh_pinyin";
+        if (!instance->inputMethodManager().entry(name)) {
+            FCITX_ERROR() << "zh-pinyin engine is not available, skip the test";
+            return;
+        }
+        RawConfig config;
+        config.setValueByPath("MaxContexts", std::to_string(maxContexts));
+        m17n->setConfig(config);
+
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(InputMethodGroupItem(name));
+        defaultGroup.setDefaultInputMethod(name);
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+
+        std::deque<ICUUID> uuids;
+        size_t heapAfterWarmUp = 0;
+        for (int i = 0; i < rounds; i++) {
+            auto uuid = testfrontend->call<ITestFrontend::createInputContext>(
+                "testapp");
+            auto *ic = instance->inputContextManager().findByUUID(uuid);
+            ic->focusIn();
+            instance->activate();
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("n"), false);
+            testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("i"), false);
+            // Nothing is shown after a reset, so the state may be evicted.
+            ic->reset();
+            ic->focusOut();
+            uuids.push_back(uuid);
+            if (uuids.size() > openInputContexts) {
+                delete instance->inputContextManager().findByUUID(
+                    uuids.front());
+                uuids.pop_front();
+            }
+
+            auto stats = StatsOf(m17n, name);
+            FCITX_ASSERT(stats.liveContexts <= maxContexts)
+                << stats.liveContexts;
+            FCITX_ASSERT(stats.pooledContexts <= maxContexts)
+                << stats.pooledContexts;
+            if (i == openInputContexts * 2) {
+                heapAfterWarmUp = HeapInUse();
+            }
+        }
+        const size_t heap = HeapInUse();
+        FCITX_INFO() << "Heap in use after warm up: " << heapAfterWarmUp
+                     << ", at the end: " << heap;
+        // Generous, each m17n context of zh-pinyin takes a few KiB and would
+        // add up to many MiB if nothing was freed.
+        FCITX_ASSERT(heap <= heapAfterWarmUp + 4 * 1024 * 1024)
+            << heapAfterWarmUp << " " << heap;
+
+        for (const auto &uuid : uuids) {
+            delete instance->inputContextManager().findByUUID(uuid);
+        }
+        FCITX_ASSERT(StatsOf(m17n, name).liveContexts == 0);
+    });
+}
+
+} // namespace
+
+int main() {
+    setupTestingEnvironment(TESTING_BINARY_DIR, {"bin"},
+                            {TESTING_BINARY_DIR "/test"});
+    char arg0[] = "testm17nstress";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,m17n,testui";
+    char *argv[] = {arg0, arg1, arg2};
+    fcitx::Log::setLogRule("default=3");
+    Instance instance(FCITX_ARRAY_SIZE(argv), argv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    testChurn(&instance);
+    instance.eventDispatcher().schedule([&instance]() { instance.exit(); });
+    instance.exec();
+
+    return 0;
+}
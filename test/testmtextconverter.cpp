@@ -0,0 +1,207 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "mtextconverter.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fcitx-utils/cutf8.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/utf8.h>
+#include <m17n-core.h>
+#include <m17n.h>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+// Count every heap allocation in the process, including the ones made by
+// libm17n and by operator new.
+namespace {
+std::atomic<size_t> allocationCount{0};
+} // namespace
+
+extern "C" {
+void *__libc_malloc(size_t size) noexcept;
+
+void *malloc(size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+}
+
+#define HAS_ALLOCATION_COUNT 1
+#endif
+
+using namespace fcitx;
+
+namespace {
+
+// The conversion that used to live in engine.cpp, kept for comparison.
+std::string OldMTextToUTF8(MText *mt) {
+    size_t bufsize =
+        (mtext_len(mt) + 1) * static_cast<size_t>(FCITX_UTF8_MAX_LENGTH);
+    std::vector<char> buf;
+    buf.resize(bufsize);
+
+    MConverter *mconv = mconv_buffer_converter(
+        Mcoding_utf_8, reinterpret_cast<unsigned char *>(buf.data()), bufsize);
+    mconv_encode(mconv, mt);
+
+    buf[mconv->nbytes] = '\0';
+    mconv_free_converter(mconv);
+    return buf.data();
+}
+
+MText *FromUTF8(const std::string &str) {
+    return mconv_decode_buffer(
+        Mcoding_utf_8, reinterpret_cast<const unsigned char *>(str.data()),
+        str.size());
+}
+
+size_t Allocations() {
+#ifdef HAS_ALLOCATION_COUNT
+    return allocationCount.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+void testConvert() {
+    const std::vector<std::string> samples{
+        "", "a", "abc", "ශ්‍රී ලංකා", "你好，世界", "한국어", "😀 emoji"};
+    MTextConverter converter;
+    std::string out;
+    for (const auto &sample : samples) {
+        MText *mt = FromUTF8(sample);
+        FCITX_ASSERT(mt);
+        converter.convert(mt, out);
+        FCITX_ASSERT(out == sample) << out << " " << sample;
+        FCITX_ASSERT(converter.convert(mt) == sample);
+        FCITX_ASSERT(OldMTextToUTF8(mt) == sample);
+        m17n_object_unref(mt);
+    }
+}
+
+void testConvertPreedit() {
+    const std::vector<std::string> samples{"", "a", "ශ්‍රී ලංකා", "你好，世界",
+                                           "😀 emoji"};
+    MTextConverter converter;
+    M17NPreedit preedit;
+    for (const auto &sample : samples) {
+        MText *mt = FromUTF8(sample);
+        FCITX_ASSERT(mt);
+        const int len = static_cast<int>(utf8::length(sample));
+        for (int cursor = -1; cursor <= len + 1; cursor++) {
+            converter.convertPreedit(mt, cursor, -1, -1, preedit);
+            FCITX_ASSERT(preedit.text == sample) << preedit.text;
+            // What the two extra passes over the string used to compute.
+            int expect = -1;
+            if (cursor >= 0 && cursor <= len) {
+                expect = utf8::ncharByteLength(sample.begin(), cursor);
+            }
+            FCITX_ASSERT(preedit.cursor == expect)
+                << sample << " " << cursor << " " << preedit.cursor;
+            FCITX_ASSERT(preedit.segmentBegin == -1);
+            FCITX_ASSERT(preedit.segmentEnd == -1);
+        }
+        m17n_object_unref(mt);
+    }
+
+    MText *mt = FromUTF8("你好，世界");
+    converter.convertPreedit(mt, 5, 3, 5, preedit);
+    FCITX_ASSERT(preedit.cursor == 15);
+    FCITX_ASSERT(preedit.segmentBegin == 9);
+    FCITX_ASSERT(preedit.segmentEnd == 15);
+    converter.convertPreedit(mt, 0, 0, 2, preedit);
+    FCITX_ASSERT(preedit.cursor == 0);
+    FCITX_ASSERT(preedit.segmentBegin == 0);
+    FCITX_ASSERT(preedit.segmentEnd == 6);
+    // Empty or out of range segments are not set.
+    converter.convertPreedit(mt, 0, 2, 2, preedit);
+    FCITX_ASSERT(preedit.segmentBegin == -1 && preedit.segmentEnd == -1);
+    converter.convertPreedit(mt, 0, 3, 9, preedit);
+    FCITX_ASSERT(preedit.segmentBegin == -1 && preedit.segmentEnd == -1);
+    m17n_object_unref(mt);
+
+    converter.convertPreedit(nullptr, -1, -1, -1, preedit);
+    FCITX_ASSERT(preedit.text.empty() && preedit.cursor == -1);
+}
+
+// Simulates a preedit growing and shrinking while typing.
+void benchmarkSteadyState() {
+    constexpr int rounds = 20000;
+    const std::string word = "ශ්‍රී ලංකා";
+    std::vector<MText *> texts;
+    for (size_t i = 1; i <= word.size(); i++) {
+        // Only cut at character boundaries.
+        if (i < word.size() && (word[i] & 0xc0) == 0x80) {
+            continue;
+        }
+        if (MText *mt = FromUTF8(word.substr(0, i))) {
+            texts.push_back(mt);
+        }
+    }
+
+    MTextConverter converter;
+    std::string out;
+    // Warm up, so out and the converter reach their steady state.
+    for (auto *mt : texts) {
+        converter.convert(mt, out);
+    }
+
+    size_t before = Allocations();
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (int i = 0; i < rounds; i++) {
+        for (auto *mt : texts) {
+            converter.convert(mt, out);
+            bytes += out.size();
+        }
+    }
+    auto newTime = std::chrono::steady_clock::now() - start;
+    size_t newAllocations = Allocations() - before;
+
+    before = Allocations();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        for (auto *mt : texts) {
+            bytes += OldMTextToUTF8(mt).size();
+        }
+    }
+    auto oldTime = std::chrono::steady_clock::now() - start;
+    size_t oldAllocations = Allocations() - before;
+
+    const double calls = static_cast<double>(rounds) * texts.size();
+    auto nsPerCall = [calls](auto duration) {
+        return std::chrono::duration<double, std::nano>(duration).count() /
+               calls;
+    };
+    FCITX_INFO() << "MTextToUTF8: " << nsPerCall(oldTime) << " ns/call, "
+                 << oldAllocations / calls << " allocations/call";
+    FCITX_INFO() << "MTextConverter: " << nsPerCall(newTime) << " ns/call, "
+                 << newAllocations / calls << " allocations/call";
+    FCITX_INFO() << "Converted " << bytes << " bytes";
+
+#ifdef HAS_ALLOCATION_COUNT
+    FCITX_ASSERT(newAllocations == 0) << newAllocations;
+    FCITX_ASSERT(oldAllocations > 0);
+#endif
+
+    for (auto *mt : texts) {
+        m17n_object_unref(mt);
+    }
+}
+
+} // namespace
+
+int main() {
+    M17N_INIT();
+    testConvert();
+    testConvertPreedit();
+    benchmarkSteadyState();
+    M17N_FINI();
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "overrideparser.h"
+#include "testdir.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <fcitx-utils/log.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+
+OverrideTable Parse(const std::string &content) {
+    FILE *file = std::tmpfile();
+    FCITX_ASSERT(file);
+    FCITX_ASSERT(std::fwrite(content.data(), 1, content.size(), file) ==
+                 content.size());
+    std::fflush(file);
+    std::rewind(file);
+    auto table = ParseDefaultSettings(fileno(file));
+    std::fclose(file);
+    return table;
+}
+
+// The linear scan over the items sorted by wildcardCount that the table
+// replaces, kept as the reference.
+struct LinearTable {
+    explicit LinearTable(const std::string &content) {
+        std::vector<std::pair<std::string, int>> lines;
+        size_t start = 0;
+        while (start < content.size()) {
+            auto end = content.find('\n', start);
+            if (end == std::string::npos) {
+                end = content.size();
+            }
+            std::string line = content.substr(start, end - start);
+            start = end + 1;
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            auto first = line.find(':');
+            auto second = line.find(':', first + 1);
+            auto third = line.find(':', second + 1);
+            OverrideItem item;
+            item.lang = line.substr(0, first);
+            item.name = line.substr(first + 1, second - first - 1);
+            item.priority = std::stoi(line.substr(second + 1, third - second));
+            item.i18nName =
+                third == std::string::npos ? "" : line.substr(third + 1);
+            item.wildcardCount = (item.name[0] == '*' ? 1 : 0) |
+                                 (item.lang[0] == '*' ? 2 : 0);
+            items.push_back(std::move(item));
+        }
+        std::stable_sort(items.begin(), items.end(),
+                         [](const auto &lhs, const auto &rhs) {
+                             return lhs.wildcardCount < rhs.wildcardCount;
+                         });
+    }
+
+    const OverrideItem *match(const std::string &lang,
+                              const std::string &name) const {
+        for (const auto &item : items) {
+            if (!((item.wildcardCount & 2) || lang == item.lang)) {
+                continue;
+            }
+            if (!((item.wildcardCount & 1) || name == item.name)) {
+                continue;
+            }
+            return &item;
+        }
+        return nullptr;
+    }
+
+    std::vector<OverrideItem> items;
+};
+
+void checkMatch(const OverrideTable &table, std::string_view lang,
+                std::string_view name, int priority) {
+    const auto *item = MatchDefaultSettings(table, lang, name);
+    FCITX_ASSERT(item) << lang << " " << name;
+    FCITX_ASSERT(item->priority == priority)
+        << lang << " " << name << " " << item->priority;
+}
+
+void testParse() {
+    auto table = Parse("# Comment\n"
+                       "\n"
+                       "   \n"
+                       "  # Indented comment\n"
+                       "hi:*:2\n"
+                       "hi:inscript:1\n"
+                       "zh:pinyin:100:Pinyin Symbol\n"
+                       "*:kbd:-1:Keyboard\n"
+                       "*:*:7\n"
+                       "hi:*:3\n"
+                       "zh:pinyin:5\n"
+                       "bad\n"
+                       "bad:line\n"
+                       "bad:priority:x\n"
+                       ":empty:1\n"
+                       "  ko:han2:-1:Hanja  \n");
+    FCITX_ASSERT(table.size() == 8) << table.size();
+
+    // Exact before name wildcard before lang wildcard before both.
+    checkMatch(table, "hi", "inscript", 1);
+    checkMatch(table, "hi", "itrans", 2);
+    checkMatch(table, "hi", "kbd", 2);
+    checkMatch(table, "ar", "kbd", -1);
+    checkMatch(table, "ar", "other", 7);
+    // The first of two items of the same kind wins.
+    checkMatch(table, "zh", "pinyin", 100);
+    FCITX_ASSERT(MatchDefaultSettings(table, "zh", "pinyin")->i18nName ==
+                 "Pinyin Symbol");
+    // Surrounding whitespace is trimmed.
+    checkMatch(table, "ko", "han2", -1);
+    FCITX_ASSERT(MatchDefaultSettings(table, "ko", "han2")->i18nName ==
+                 "Hanja");
+    checkMatch(table, "bad", "priority", 7);
+
+    auto empty = Parse("# Nothing\n");
+    FCITX_ASSERT(empty.empty());
+    FCITX_ASSERT(!MatchDefaultSettings(empty, "hi", "inscript"));
+
+    // Moving keeps the index valid.
+    OverrideTable moved = std::move(table);
+    checkMatch(moved, "hi", "itrans", 2);
+}
+
+// The file shipped in im/default, which the engine now reads in full.
+void testDefaultFile() {
+    FILE *file = std::fopen(TESTING_SOURCE_DIR "/im/default", "r");
+    FCITX_ASSERT(file);
+    auto table = ParseDefaultSettings(fileno(file));
+    std::fclose(file);
+    FCITX_ASSERT(table.size() == 44) << table.size();
+
+    checkMatch(table, "hi", "inscript", 1);
+    checkMatch(table, "hi", "itrans", 2);
+    checkMatch(table, "si", "wijesekera", 1);
+    checkMatch(table, "zh", "pinyin", 100);
+    checkMatch(table, "zh", "py", -1);
+    FCITX_ASSERT(MatchDefaultSettings(table, "zh", "py")->i18nName ==
+                 "Pinyin");
+    checkMatch(table, "ko", "han2", -1);
+    FCITX_ASSERT(MatchDefaultSettings(table, "ko", "han2")->i18nName ==
+                 "Hanja");
+    checkMatch(table, "ar", "kbd", -1);
+    FCITX_ASSERT(MatchDefaultSettings(table, "ar", "kbd")->i18nName ==
+                 "Keyboard");
+    FCITX_ASSERT(!MatchDefaultSettings(table, "t", "latn-pre"));
+}
+
+std::string SyntheticFile(int languages, int namesPerLanguage) {
+    std::string content = "# Synthetic\n";
+    for (int lang = 0; lang < languages; lang++) {
+        const auto langName = "l" + std::to_string(lang);
+        if (lang % 3 == 0) {
+            content += langName + ":*:" + std::to_string(lang) + "\n";
+        }
+        for (int name = 0; name < namesPerLanguage; name++) {
+            if ((lang + name) % 4 == 0) {
+                continue;
+            }
+            content += langName + ":n" + std::to_string(name) + ":" +
+                       std::to_string(lang * 1000 + name) + ":Name\n";
+        }
+    }
+    for (int name = 0; name < namesPerLanguage; name += 7) {
+        content += "*:n" + std::to_string(name) + ":-" +
+                   std::to_string(name + 1) + "\n";
+    }
+    content += "*:*:42\n";
+    return content;
+}
+
+// Compare with the linear scan on thousands of lines, and time both.
+void benchmarkMatch() {
+    constexpr int languages = 200;
+    constexpr int namesPerLanguage = 30;
+    const auto content = SyntheticFile(languages, namesPerLanguage);
+
+    auto start = std::chrono::steady_clock::now();
+    auto table = Parse(content);
+    auto parseTime = std::chrono::steady_clock::now() - start;
+    LinearTable linear(content);
+    FCITX_ASSERT(table.size() == linear.items.size())
+        << table.size() << " " << linear.items.size();
+
+    std::vector<std::pair<std::string, std::string>> queries;
+    for (int lang = 0; lang < languages + 10; lang++) {
+        for (int name = 0; name < namesPerLanguage + 5; name++) {
+            queries.emplace_back("l" + std::to_string(lang),
+                                 "n" + std::to_string(name));
+        }
+    }
+
+    for (const auto &[lang, name] : queries) {
+        const auto *expected = linear.match(lang, name);
+        const auto *actual = MatchDefaultSettings(table, lang, name);
+        FCITX_ASSERT((expected == nullptr) == (actual == nullptr));
+        if (!expected) {
+            continue;
+        }
+        FCITX_ASSERT(actual->lang == expected->lang &&
+                     actual->name == expected->name &&
+                     actual->priority == expected->priority)
+            << lang << " " << name;
+    }
+
+    size_t matched = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto &[lang, name] : queries) {
+        matched += MatchDefaultSettings(table, lang, name) != nullptr;
+    }
+    auto indexedTime = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (const auto &[lang, name] : queries) {
+        matched += linear.match(lang, name) != nullptr;
+    }
+    auto linearTime = std::chrono::steady_clock::now() - start;
+
+    auto nsPerQuery = [&queries](auto duration) {
+        return std::chrono::duration<double, std::nano>(duration).count() /
+               queries.size();
+    };
+    FCITX_INFO() << "Parsed " << table.size() << " items in "
+                 << std::chrono::duration<double, std::milli>(parseTime).count()
+                 << " ms";
+    FCITX_INFO() << "Linear match: " << nsPerQuery(linearTime)
+                 << " ns/query, indexed match: " << nsPerQuery(indexedTime)
+                 << " ns/query, " << matched << " matches";
+}
+
+} // namespace
+
+int main() {
+    testParse();
+    testDefaultFile();
+    benchmarkMatch();
+    return 0;
+}
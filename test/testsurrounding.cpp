@@ -0,0 +1,132 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "testdir.h"
+#include "testfrontend_public.h"
+#include <cstdlib>
+#include <fcitx-config/rawconfig.h>
+#include <fcitx-utils/capabilityflags.h>
+#include <fcitx-utils/eventdispatcher.h>
+#include <fcitx-utils/key.h>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/macros.h>
+#include <fcitx-utils/testing.h>
+#include <fcitx/addonmanager.h>
+#include <fcitx/inputcontextmanager.h>
+#include <fcitx/inputmethodgroup.h>
+#include <fcitx/inputmethodmanager.h>
+#include <fcitx/instance.h>
+#include <filesystem>
+#include <fstream>
+
+using namespace fcitx;
+
+namespace {
+
+constexpr char inputMethodName[] = "m17n_t_surrounding-test";
+
+// "a" after "x" replaces the "x" with "Y", which needs the character before
+// the cursor.
+constexpr char surroundingTestMim[] = R"((input-method t surrounding-test)
+(description "Looks at the character before the cursor.")
+(title "ST")
+(map
+ (trans
+  ("a" (cond ((= @-1 ?x) (delete @-1) "Y")
+             (1 "a")))))
+(state
+ (init
+  (trans)))
+)";
+
+// m17n also reads the input methods in ~/.m17n.d.
+void setupHome() {
+    const std::filesystem::path home =
+        TESTING_BINARY_DIR "/test/surrounding-home";
+    std::filesystem::create_directories(home / ".m17n.d");
+    std::ofstream(home / ".m17n.d" / "t-surrounding-test.mim")
+        << surroundingTestMim;
+    setenv("HOME", home.c_str(), 1);
+}
+
+void testEmulateSurroundingText(Instance *instance) {
+    instance->eventDispatcher().schedule([instance]() {
+        auto *m17n = instance->addonManager().addon("m17n", true);
+        FCITX_ASSERT(m17n);
+        if (!instance->inputMethodManager().entry(inputMethodName)) {
+            FCITX_ERROR() << "surrounding-test engine is not available, skip "
+                             "the test";
+            return;
+        }
+        auto defaultGroup = instance->inputMethodManager().currentGroup();
+        defaultGroup.inputMethodList().clear();
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem("keyboard-us"));
+        defaultGroup.inputMethodList().push_back(
+            InputMethodGroupItem(inputMethodName));
+        defaultGroup.setDefaultInputMethod(inputMethodName);
+        instance->inputMethodManager().setGroup(defaultGroup);
+        auto *testfrontend = instance->addonManager().addon("testfrontend");
+        auto uuid =
+            testfrontend->call<ITestFrontend::createInputContext>("testapp");
+        auto *ic = instance->inputContextManager().findByUUID(uuid);
+        ic->setCapabilityFlags(CapabilityFlags{});
+        ic->focusIn();
+        instance->activate();
+        FCITX_ASSERT(instance->inputMethod(ic) == inputMethodName);
+
+        // "x" goes to the client, the engine remembers it.
+        testfrontend->call<ITestFrontend::pushCommitExpectation>("Y");
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("x"), false);
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+        // The "x" is gone, only the committed "Y" is before the cursor.
+        testfrontend->call<ITestFrontend::pushCommitExpectation>("a");
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+
+        // A reset forgets the text.
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("x"), false);
+        ic->reset();
+        testfrontend->call<ITestFrontend::pushCommitExpectation>("a");
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+
+        // A terminal can't be told to delete the "x", so there is no text.
+        ic->setCapabilityFlags(CapabilityFlag::Terminal);
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("x"), false);
+        testfrontend->call<ITestFrontend::pushCommitExpectation>("a");
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+        ic->setCapabilityFlags(CapabilityFlags{});
+
+        RawConfig config;
+        config.setValueByPath("EmulateSurroundingText", "False");
+        m17n->setConfig(config);
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("x"), false);
+        testfrontend->call<ITestFrontend::pushCommitExpectation>("a");
+        testfrontend->call<ITestFrontend::keyEvent>(uuid, Key("a"), false);
+        config.setValueByPath("EmulateSurroundingText", "True");
+        m17n->setConfig(config);
+        delete ic;
+    });
+}
+
+} // namespace
+
+int main() {
+    setupHome();
+    setupTestingEnvironment(TESTING_BINARY_DIR, {"bin"},
+                            {TESTING_BINARY_DIR "/test"});
+    char arg0[] = "testsurrounding";
+    char arg1[] = "--disable=all";
+    char arg2[] = "--enable=testim,testfrontend,m17n,testui";
+    char *argv[] = {arg0, arg1, arg2};
+    fcitx::Log::setLogRule("default=5,m17n=5");
+    Instance instance(FCITX_ARRAY_SIZE(argv), argv);
+    instance.addonManager().registerDefaultLoader(nullptr);
+    testEmulateSurroundingText(&instance);
+    instance.eventDispatcher().schedule([&instance]() { instance.exit(); });
+    instance.exec();
+
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * SPDX-FileCopyrightText: 2026~2026 agent <agent@local>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ *
+ */
+#include "testdir.h"
+#include "usage.h"
+#include <cstdint>
+#include <fcitx-utils/log.h>
+#include <fcitx-utils/testing.h>
+#include <vector>
+
+using namespace fcitx;
+
+namespace {
+
+M17NUsage Usage(const char *language, const char *name, uint64_t keys,
+                int64_t lastUsed) {
+    M17NUsage usage;
+    usage.language = language;
+    usage.name = name;
+    usage.keys = keys;
+    usage.lastUsed = lastUsed;
+    return usage;
+}
+
+void testMostUsed() {
+    std::vector<M17NUsage> usage{
+        Usage("hi", "inscript", 10, 100), Usage("si", "wijesekara", 50, 10),
+        Usage("zh", "pinyin", 10, 200), Usage("ko", "han2", 1, 300)};
+    auto top = MostUsed(usage, 3);
+    FCITX_ASSERT(top.size() == 3);
+    FCITX_ASSERT(top[0].name == "wijesekara");
+    // Ties are broken by the last use.
+    FCITX_ASSERT(top[1].name == "pinyin");
+    FCITX_ASSERT(top[2].name == "inscript");
+    FCITX_ASSERT(MostUsed(usage, 0).empty());
+    FCITX_ASSERT(MostUsed(usage, 10).size() == 4);
+}
+
+void testSaveLoad() {
+    std::vector<M17NUsage> usage{Usage("hi", "inscript", 10, 100),
+                                 Usage("t", "latn-pre", 123456789012ULL, -1),
+                                 Usage("bad", "na\tme", 1, 1)};
+    FCITX_ASSERT(SaveUsage(usage));
+    auto loaded = LoadUsage();
+    // Names that can't be stored are dropped.
+    FCITX_ASSERT(loaded.size() == 2) << loaded.size();
+    FCITX_ASSERT(loaded[0].language == "hi" && loaded[0].name == "inscript" &&
+                 loaded[0].keys == 10 && loaded[0].lastUsed == 100);
+    FCITX_ASSERT(loaded[1].language == "t" && loaded[1].name == "latn-pre" &&
+                 loaded[1].keys == 123456789012ULL &&
+                 loaded[1].lastUsed == -1);
+
+    FCITX_ASSERT(SaveUsage({}));
+    FCITX_ASSERT(LoadUsage().empty());
+}
+
+} // namespace
+
+int main() {
+    setupTestingEnvironment(TESTING_BINARY_DIR, {"bin"},
+                            {TESTING_BINARY_DIR "/test"});
+    testMostUsed();
+    testSaveLoad();
+    return 0;
+}